@@ -11,6 +11,32 @@
 #define T3_TICKS      375 / RMT_TICK // 375ns
 #define RESET_TICKS 50000 / RMT_TICK // 50us
 
+// RMT memory blocks per channel (64 items each). The driver refills half of the
+// channel memory per interrupt, so more blocks mean fewer refill interrupts per frame.
+#ifndef RMT_MEM_BLOCKS
+#define RMT_MEM_BLOCKS 2
+#endif
+
+// A channel with more than one memory block uses the blocks of the following
+// channels, so the 8 blocks limit the number of outputs.
+#define RMT_MAX_CHANNELS (8 / RMT_MEM_BLOCKS)
+
+/*
+ * Lookup table with the RMT items for every 4 bit value (MSB first).
+ * Kept in DRAM, the translator runs in interrupt context.
+ */
+static DRAM_ATTR uint32_t nibble_items[16][4];
+
+static void rmt_init_lookup() {
+    const rmt_item32_t bit0  = {{{ T1_TICKS,            1, T2_TICKS + T3_TICKS, 0 }}}; //Logical 0
+    const rmt_item32_t bit1  = {{{ T1_TICKS + T2_TICKS, 1, T3_TICKS           , 0 }}}; //Logical 1
+    for (uint8_t nibble = 0; nibble < 16; nibble++) {
+      for (uint8_t bit = 0; bit < 4; bit++) {
+        nibble_items[nibble][bit] = (nibble & (0x08 >> bit)) ? bit1.val : bit0.val;
+      }
+    }
+}
+
 /*
  * Convert uint8_t type of data to rmt format data.
  */
@@ -21,8 +47,6 @@ static void IRAM_ATTR u8_to_rmt(const void* src, rmt_item32_t* dest, size_t src_
         *item_num = 0;
         return;
     }
-    const rmt_item32_t bit0  = {{{ T1_TICKS,            1, T2_TICKS + T3_TICKS, 0 }}}; //Logical 0
-    const rmt_item32_t bit1  = {{{ T1_TICKS + T2_TICKS, 1, T3_TICKS           , 0 }}}; //Logical 1
     const rmt_item32_t reset = {{{ RESET_TICKS/2      , 0, RESET_TICKS/2      , 0 }}}; //Reset
     size_t size = 0;
     size_t num = 0;
@@ -30,14 +54,17 @@ static void IRAM_ATTR u8_to_rmt(const void* src, rmt_item32_t* dest, size_t src_
     rmt_item32_t* pdest = dest;
     while (size < src_size && num < wanted_num) {
       if(size < src_size - 1) { // have more pixel data, so translate into RMT items
-        (pdest++)->val =  (*psrc & B10000000) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B01000000) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00100000) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00010000) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00001000) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00000100) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00000010) ? bit1.val : bit0.val;
-        (pdest++)->val =  (*psrc & B00000001) ? bit1.val : bit0.val;
+        const uint32_t* high = nibble_items[*psrc >> 4];
+        const uint32_t* low = nibble_items[*psrc & 0x0F];
+        pdest[0].val = high[0];
+        pdest[1].val = high[1];
+        pdest[2].val = high[2];
+        pdest[3].val = high[3];
+        pdest[4].val = low[0];
+        pdest[5].val = low[1];
+        pdest[6].val = low[2];
+        pdest[7].val = low[3];
+        pdest += 8;
         num += 8;
       } else { // no more pixel data, last RMT item is the reset pulse
         (pdest++)->val =  reset.val;
@@ -50,6 +77,77 @@ static void IRAM_ATTR u8_to_rmt(const void* src, rmt_item32_t* dest, size_t src_
     *item_num = num;
 }
 
+/*
+ * Output channels. The strip is split evenly across them in pixel order and
+ * all parts are sent at the same time.
+ */
+static rmt_channel_t tx_channels[RMT_MAX_CHANNELS];
+static uint8_t tx_num_channels = 0;
+
+/*
+ * Ping-pong transmit buffers. A frame is copied into one buffer while the
+ * driver may still be translating and sending the previous frame from the other.
+ */
+static uint8_t* tx_buffers[2] = { NULL, NULL };
+static size_t tx_buffer_size = 0;
+static uint8_t tx_buffer_index = 0;
+static size_t tx_last_size = 0;
+
+/*
+ * Buffer to prepare the next frame in, it is only handed to the driver by rmt_write_tx_buffer().
+ * Returns NULL if the buffers for a longer frame cannot be allocated.
+ */
+static uint8_t* rmt_next_tx_buffer(size_t size) {
+    if (size > tx_buffer_size) {
+        // the buffers may still be in use by the driver
+        for (uint8_t i = 0; i < tx_num_channels; i++) {
+            rmt_wait_tx_done(tx_channels[i], portMAX_DELAY);
+        }
+        tx_last_size = 0;
+        for (uint8_t i = 0; i < 2; i++) {
+            free(tx_buffers[i]);
+            tx_buffers[i] = (uint8_t*)malloc(size);
+        }
+        if (tx_buffers[0] == NULL || tx_buffers[1] == NULL) {
+            free(tx_buffers[0]);
+            free(tx_buffers[1]);
+            tx_buffers[0] = tx_buffers[1] = NULL;
+            tx_buffer_size = 0;
+            return NULL;
+        }
+        tx_buffer_size = size;
+    }
+    return tx_buffers[tx_buffer_index ^ 1];
+}
+
+/*
+ * Check if the prepared frame equals the last one handed to the driver
+ */
+static bool rmt_tx_unchanged(size_t size) {
+    return size == tx_last_size && memcmp(tx_buffers[0], tx_buffers[1], size) == 0;
+}
+
+/*
+ * Send the prepared frame on all channels, size includes the reset byte
+ */
+static esp_err_t rmt_write_tx_buffer(size_t size, uint8_t pixel_size) {
+    tx_buffer_index ^= 1;
+    tx_last_size = size - 1; // without the reset byte
+    size_t pixels = tx_last_size / pixel_size;
+    size_t start = 0;
+    esp_err_t result = ESP_OK;
+    for (uint8_t i = 0; i < tx_num_channels; i++) {
+        size_t end = pixels * (i + 1) / tx_num_channels * pixel_size;
+        // the byte after each part stands for the reset pulse, the translator never reads it
+        esp_err_t err = rmt_write_sample(tx_channels[i], tx_buffers[tx_buffer_index] + start, end - start + 1, false);
+        if (err != ESP_OK) {
+            result = err;
+        }
+        start = end;
+    }
+    return result;
+}
+
 /*
  * Initialize the RMT Tx channel
  */
@@ -59,13 +157,39 @@ static void rmt_tx_int(rmt_channel_t channel, uint8_t gpio) {
     config.channel = channel;
     config.gpio_num = gpio_num_t(gpio);
     config.clk_div = RMT_CLK_DIV;
-    config.mem_block_num = 1; // 64 pulse "items" per block
+    config.mem_block_num = RMT_MEM_BLOCKS; // 64 pulse "items" per block
     config.tx_config.loop_en = 0;
     config.tx_config.carrier_en = 0;
     config.tx_config.idle_output_en = 1;
     config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
 
+    rmt_init_lookup();
     rmt_config(&config);
     rmt_driver_install(config.channel, 0, 0);
     rmt_translator_init(config.channel, u8_to_rmt);
-}
\ No newline at end of file
+}
+
+/*
+ * Initialize one Tx channel per GPIO of a comma separated list, e.g. "13,14".
+ * Uses default_gpio if the list is empty. Returns the number of channels.
+ */
+static uint8_t rmt_tx_init_pins(const char* gpios, uint8_t default_gpio) {
+    tx_num_channels = 0;
+    const char* p = gpios;
+    while (*p && tx_num_channels < RMT_MAX_CHANNELS) {
+        char* end;
+        long gpio = strtol(p, &end, 10);
+        if (end == p || gpio < 0) {
+            break;
+        }
+        rmt_channel_t channel = rmt_channel_t(tx_num_channels * RMT_MEM_BLOCKS);
+        rmt_tx_int(channel, gpio);
+        tx_channels[tx_num_channels++] = channel;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    if (tx_num_channels == 0) {
+        rmt_tx_int(RMT_CHANNEL_0, default_gpio);
+        tx_channels[tx_num_channels++] = RMT_CHANNEL_0;
+    }
+    return tx_num_channels;
+}
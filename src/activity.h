@@ -0,0 +1,78 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Presence activities
+ *
+ * Activity names reported by the Graph API and their mapping to ids. Kept apart from the
+ * animations, so it does not depend on WS2812FX.
+ */
+// Activities reported by the Graph API
+enum Activity {
+	ACTIVITY_AVAILABLE,
+	ACTIVITY_AWAY,
+	ACTIVITY_BERIGHTBACK,
+	ACTIVITY_BUSY,
+	ACTIVITY_DONOTDISTURB,
+	ACTIVITY_URGENTINTERRUPTIONSONLY,
+	ACTIVITY_INACALL,
+	ACTIVITY_INACONFERENCECALL,
+	ACTIVITY_INACTIVE,
+	ACTIVITY_INAMEETING,
+	ACTIVITY_OFFLINE,
+	ACTIVITY_OFFWORK,
+	ACTIVITY_OUTOFOFFICE,
+	ACTIVITY_PRESENCEUNKNOWN,
+	ACTIVITY_PRESENTING,
+	ACTIVITY_COUNT,
+	ACTIVITY_UNKNOWN = ACTIVITY_COUNT
+};
+
+const char* const activityNames[ACTIVITY_COUNT] = {
+	"Available", "Away", "BeRightBack", "Busy", "DoNotDisturb", "UrgentInterruptionsOnly", "InACall", "InAConferenceCall",
+	"Inactive", "InAMeeting", "Offline", "OffWork", "OutOfOffice", "PresenceUnknown", "Presenting"
+};
+
+// FNV-1a hash, usable at compile time for the switch below
+constexpr uint32_t activityHash(const char* s, uint32_t h = 2166136261u) {
+	return *s ? activityHash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+// Map activity name to its id with a single hash (duplicate hashes would not compile)
+Activity getActivity(const char* name) {
+	Activity id;
+	switch (activityHash(name)) {
+		case activityHash("Available"): id = ACTIVITY_AVAILABLE; break;
+		case activityHash("Away"): id = ACTIVITY_AWAY; break;
+		case activityHash("BeRightBack"): id = ACTIVITY_BERIGHTBACK; break;
+		case activityHash("Busy"): id = ACTIVITY_BUSY; break;
+		case activityHash("DoNotDisturb"): id = ACTIVITY_DONOTDISTURB; break;
+		case activityHash("UrgentInterruptionsOnly"): id = ACTIVITY_URGENTINTERRUPTIONSONLY; break;
+		case activityHash("InACall"): id = ACTIVITY_INACALL; break;
+		case activityHash("InAConferenceCall"): id = ACTIVITY_INACONFERENCECALL; break;
+		case activityHash("Inactive"): id = ACTIVITY_INACTIVE; break;
+		case activityHash("InAMeeting"): id = ACTIVITY_INAMEETING; break;
+		case activityHash("Offline"): id = ACTIVITY_OFFLINE; break;
+		case activityHash("OffWork"): id = ACTIVITY_OFFWORK; break;
+		case activityHash("OutOfOffice"): id = ACTIVITY_OUTOFOFFICE; break;
+		case activityHash("PresenceUnknown"): id = ACTIVITY_PRESENCEUNKNOWN; break;
+		case activityHash("Presenting"): id = ACTIVITY_PRESENTING; break;
+		default: return ACTIVITY_UNKNOWN;
+	}
+	// Guard against unknown names that happen to share a hash
+	return strcmp(name, activityNames[id]) == 0 ? id : ACTIVITY_UNKNOWN;
+}
+
+// Activities shown when nobody is around
+bool isOfflineActivity(Activity id) {
+	return id == ACTIVITY_OFFLINE || id == ACTIVITY_OFFWORK || id == ACTIVITY_OUTOFOFFICE || id == ACTIVITY_PRESENCEUNKNOWN;
+}
@@ -0,0 +1,39 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Animation per activity, the host emulator renders the same table
+ */
+struct PresenceAnimation {
+	uint8_t mode;
+	uint32_t color;
+	uint16_t speed;
+};
+
+// Default animation per activity, can be overridden by ANIMATIONS_FILE
+PresenceAnimation presenceAnimations[ACTIVITY_COUNT] = {
+	{ FX_MODE_STATIC, GREEN, 3000 },		// Available
+	{ FX_MODE_STATIC, YELLOW, 3000 },		// Away
+	{ FX_MODE_STATIC, ORANGE, 3000 },		// BeRightBack
+	{ FX_MODE_STATIC, PURPLE, 3000 },		// Busy
+	{ FX_MODE_STATIC, PINK, 3000 },			// DoNotDisturb
+	{ FX_MODE_STATIC, PINK, 3000 },			// UrgentInterruptionsOnly
+	{ FX_MODE_BREATH, RED, 3000 },			// InACall
+	{ FX_MODE_BREATH, RED, 9000 },			// InAConferenceCall
+	{ FX_MODE_BREATH, WHITE, 3000 },		// Inactive
+	{ FX_MODE_SCAN, RED, 3000 },			// InAMeeting
+	{ FX_MODE_STATIC, BLACK, 3000 },		// Offline
+	{ FX_MODE_STATIC, BLACK, 3000 },		// OffWork
+	{ FX_MODE_STATIC, BLACK, 3000 },		// OutOfOffice
+	{ FX_MODE_STATIC, BLACK, 3000 },		// PresenceUnknown
+	{ FX_MODE_COLOR_WIPE, RED, 3000 }		// Presenting
+};
@@ -0,0 +1,141 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * HTTP response body stream
+ *
+ * Reads a response body from a persistent connection. Chunked transfer encoding is decoded
+ * and a body with Content-Length ends after that many bytes, so it is known when the whole
+ * response has been read and the connection can carry the next request.
+ */
+#define BODY_LENGTH_UNKNOWN -1					// Body ends when the connection is closed
+#define BODY_TIMEOUT 10000						// Default wait for the next byte of the body (ms)
+
+class BodyStream : public Stream {
+public:
+	// Length of the body from Content-Length, or BODY_LENGTH_UNKNOWN
+	BodyStream(Stream& stream, int length, boolean chunked, unsigned long timeout = BODY_TIMEOUT) :
+		_stream(stream), _chunked(chunked), _unbounded(!chunked && length < 0),
+		_remaining(chunked || length < 0 ? 0 : length), _first(true), _done(!chunked && length == 0), _failed(false) {
+		setTimeout(timeout);
+	}
+
+	int available() {
+		if (_done) {
+			return 0;
+		}
+		int available = _stream.available();
+		return _chunked || _unbounded ? available : min(available, (int)_remaining);
+	}
+	int peek() { return nextChunk() ? _stream.peek() : -1; }
+	int read() {
+		if (!nextChunk()) {
+			return -1;
+		}
+		int c = _stream.read();
+		if (c >= 0 && !_unbounded) {
+			_remaining--;
+			if (!_chunked && _remaining == 0) {
+				_done = true;
+			}
+		}
+		return c;
+	}
+	size_t write(uint8_t) { return 0; }
+	void flush() {}
+
+	// The whole body has been read and nothing of it is left on the connection
+	boolean complete() { return _done && !_failed; }
+
+	// Read up to length bytes, stops at the end of the body without waiting for the timeout
+	size_t readBody(char* buffer, size_t length) {
+		size_t count = 0;
+		while (count < length) {
+			int c = timedBodyRead();
+			if (c < 0) {
+				break;
+			}
+			buffer[count++] = c;
+		}
+		return count;
+	}
+
+	// Skip the rest of the body, at most limit bytes. Returns true if the end was reached.
+	boolean drain(size_t limit) {
+		while (!_done && limit > 0 && timedBodyRead() >= 0) {
+			limit--;
+		}
+		return complete();
+	}
+
+private:
+	Stream& _stream;
+	boolean _chunked;
+	boolean _unbounded;
+	size_t _remaining;			// Bytes left in the current chunk or body
+	boolean _first;
+	boolean _done;
+	boolean _failed;			// Chunk framing was broken or timed out
+
+	// Wait for the next byte, unlike timedRead() it returns at once at the end of the body
+	int timedBodyRead() {
+		unsigned long tsStart = millis();
+		do {
+			int c = read();
+			if (c >= 0 || _done) {
+				return c;
+			}
+			delay(1);
+		} while (millis() - tsStart < _timeout);
+		return -1;
+	}
+
+	// Read a line without its line feed, returns false on timeout
+	boolean readLine(char* line, size_t capacity, size_t& length) {
+		length = _stream.readBytesUntil('\n', line, capacity - 1);
+		line[length] = 0;
+		if (length > 0 && line[length - 1] == '\r') {
+			line[--length] = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// Read the next chunk size line (and the CRLF closing the previous chunk)
+	boolean nextChunk() {
+		if (_done) {
+			return false;
+		}
+		if (!_chunked || _remaining > 0) {
+			return true;
+		}
+		char line[16];
+		size_t length;
+		if ((!_first && (!readLine(line, sizeof(line), length) || length > 0)) || !readLine(line, sizeof(line), length) || length == 0) {
+			_failed = _done = true;
+			return false;
+		}
+		_first = false;
+		_remaining = strtoul(line, NULL, 16);
+		if (_remaining == 0) {
+			// Last chunk, skip the trailer up to the empty line closing the body
+			do {
+				if (!readLine(line, sizeof(line), length)) {
+					_failed = true;
+					break;
+				}
+			} while (length > 0);
+			_done = true;
+		}
+		return !_done;
+	}
+};
@@ -0,0 +1,109 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Colour pipeline
+ *
+ * Gamma, brightness and colour temperature are folded into one lookup table per channel
+ * with 8.8 fixed point entries. The tables are built when the configuration changes, a
+ * frame only needs three table lookups and an add per pixel while it is copied into the
+ * transmit buffer. The fractional part is spread over 8 frames by ordered temporal
+ * dithering, so dim colours keep their steps. Dithering needs a new frame every period,
+ * so a frame that does not change is only dithered COLOR_DITHER_REPEATS more times and
+ * then rounded, after that the LED task can sleep while a static colour is shown.
+ */
+#ifndef COLOR_GAMMA
+#define COLOR_GAMMA 2.2f						// Gamma correction of the LED output (if not set via build flags)
+#endif
+#ifndef COLOR_DITHERING
+#define COLOR_DITHERING 1						// Temporal dithering of the fractional part, 0 to round instead (if not set via build flags)
+#endif
+#ifndef COLOR_DITHER_REPEATS
+#define COLOR_DITHER_REPEATS 0					// Times an unchanged frame is dithered again before it is rounded (if not set via build flags)
+#endif
+#define DEFAULT_COLOR_BRIGHTNESS "20"			// Default brightness (percent)
+#define DEFAULT_COLOR_TEMPERATURE "6500"		// Default colour temperature (K)
+#define COLOR_TEMPERATURE_NEUTRAL 6500			// Colour temperature that is shown unchanged (K)
+
+// Output per channel and input value in 8.8 fixed point, channels in pixel buffer order (GRB).
+// Two sets, so a new table never shows up half built.
+uint16_t colorLuts[2][3][256];
+uint16_t (*colorLut)[256] = colorLuts[0];
+bool colorLutChanged = false;			// Table changed since the last frame
+bool colorFrameDithered = false;		// Last frame had fractional values, it has to be repeated to dither
+uint8_t colorFrame = 0;
+uint16_t colorRepeats = 0;				// Unchanged frames sent in a row
+
+// Threshold per frame, every fraction of 1/8 is reached once in 8 frames
+const uint8_t colorDither[8] = { 0, 128, 64, 192, 32, 160, 96, 224 };
+
+// Approximate RGB of a black body, 0..255 (Tanner Helland's fit)
+void colorTemperatureToRgb(uint16_t kelvin, float rgb[3]) {
+	float t = kelvin / 100.0f;
+	rgb[0] = t <= 66 ? 255 : 329.698727446f * powf(t - 60, -0.1332047592f);
+	rgb[1] = t <= 66 ? 99.4708025861f * logf(t) - 161.1195681661f : 288.1221695283f * powf(t - 60, -0.0755148492f);
+	rgb[2] = t >= 66 ? 255 : (t <= 19 ? 0 : 138.5177312231f * logf(t - 10) - 305.0447927307f);
+	for (uint8_t c = 0; c < 3; c++) {
+		rgb[c] = constrain(rgb[c], 0.0f, 255.0f);
+	}
+}
+
+// Build the tables for brightness (percent) and colour temperature (K), may be called from any task
+void buildColorLut(uint8_t brightness, uint16_t kelvin) {
+	float rgb[3], neutral[3], scale[3];
+	colorTemperatureToRgb(kelvin, rgb);
+	colorTemperatureToRgb(COLOR_TEMPERATURE_NEUTRAL, neutral);
+	float maxScale = 0;
+	for (uint8_t c = 0; c < 3; c++) {
+		scale[c] = rgb[c] / neutral[c];
+		maxScale = max(maxScale, scale[c]);
+	}
+
+	static const uint8_t channels[3] = { 1, 0, 2 };	// Pixel buffer order to RGB
+	uint16_t (*lut)[256] = colorLut == colorLuts[0] ? colorLuts[1] : colorLuts[0];
+	for (uint8_t c = 0; c < 3; c++) {
+		float factor = scale[channels[c]] / maxScale * min(brightness, (uint8_t)100) / 100.0f * 255 * 256;
+		for (uint16_t i = 0; i < 256; i++) {
+			lut[c][i] = (uint16_t)(powf(i / 255.0f, COLOR_GAMMA) * factor + 0.5f);
+		}
+	}
+	__atomic_store_n(&colorLut, lut, __ATOMIC_RELEASE);
+	colorLutChanged = true;
+}
+
+// Correct the frame while copying it into the transmit buffer (size in bytes, GRB pixels),
+// repeat tells that the pixels are the same as in the last call
+void applyColorPipeline(const uint8_t* pixels, uint8_t* out, size_t size, bool repeat = false) {
+	uint16_t (*lut)[256] = __atomic_load_n(&colorLut, __ATOMIC_ACQUIRE);
+	colorRepeats = repeat && !colorLutChanged ? min(colorRepeats + 1, 0xFFFF) : 0;
+	colorLutChanged = false;
+	bool dither = COLOR_DITHERING && colorRepeats <= COLOR_DITHER_REPEATS;
+	uint8_t phase = colorFrame++;		// Neighbouring pixels are one threshold apart
+	uint16_t fractions = 0;
+	for (size_t i = 0; i + 2 < size; i += 3, phase++) {
+		uint16_t threshold = dither ? colorDither[phase & 7] : 128;
+		uint16_t g = lut[0][pixels[i]];
+		uint16_t r = lut[1][pixels[i + 1]];
+		uint16_t b = lut[2][pixels[i + 2]];
+		fractions |= g | r | b;
+		// Max. entry is 255 * 256, so adding a threshold below 256 never overflows
+		out[i] = (g + threshold) >> 8;
+		out[i + 1] = (r + threshold) >> 8;
+		out[i + 2] = (b + threshold) >> 8;
+	}
+	colorFrameDithered = dither && (fractions & 0xFF) != 0;
+}
+
+// The frame has to be sent again even though WS2812FX did not render a new one
+bool colorNeedsRefresh() {
+	return colorFrameDithered || colorLutChanged;
+}
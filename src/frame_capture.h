@@ -0,0 +1,127 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Frame capture
+ *
+ * A ring of framebuffers that keeps the last frames rendered by WS2812FX (before the colour
+ * pipeline) with the full strip and the mode of every segment. They can be written as a PPM
+ * image with one row per frame, or as ANSI colours for a terminal. On the device the ring
+ * gets LED_CAPTURE_BYTES of RAM and is served on /api/frames; the host emulator of the native
+ * tests gives it as much memory as it needs. Render time is not kept: WS2812FX yields for a
+ * tick before every frame it shows, so on the device it cannot be told apart from rendering.
+ * The emulator measures it instead.
+ */
+#ifndef LED_CAPTURE_BYTES
+#define LED_CAPTURE_BYTES 0						// RAM for captured frames on the device, 0 to disable (if not set via build flags)
+#endif
+#define CAPTURE_MAX_SEGMENTS 10					// Segment modes kept per frame, MAX_NUM_SEGMENTS of WS2812FX
+
+struct CapturedFrame {
+	uint32_t time;							// millis() when rendered
+	uint32_t length;						// Bytes of pixel data (GRB), they follow the header
+	uint8_t numSegments;
+	uint8_t modes[CAPTURE_MAX_SEGMENTS];	// Mode of every segment
+};
+
+struct FrameRing {
+	uint8_t* slots;			// Each slot holds a header and frameBytes of pixels
+	size_t slotSize;
+	uint32_t numSlots;
+	size_t frameBytes;		// Pixel bytes kept per frame, longer frames are cut
+	uint32_t count;			// Frames ever captured
+};
+
+// Split memory into slots for frames of frameBytes, the ring is empty afterwards
+void initFrameRing(FrameRing& r, uint8_t* memory, size_t size, size_t frameBytes) {
+	r.slots = memory;
+	r.frameBytes = frameBytes;
+	r.slotSize = (sizeof(CapturedFrame) + frameBytes + 3) & ~(size_t)3;
+	r.numSlots = size / r.slotSize;
+	__atomic_store_n(&r.count, 0, __ATOMIC_RELEASE);
+}
+
+CapturedFrame& getCapturedFrame(const FrameRing& r, uint32_t index) {
+	return *(CapturedFrame*)(r.slots + (index % r.numSlots) * r.slotSize);
+}
+
+const uint8_t* getFramePixels(const CapturedFrame& frame) {
+	return (const uint8_t*)(&frame + 1);
+}
+
+// Store a frame, only called by one task
+void captureFrame(FrameRing& r, const uint8_t* pixels, size_t size, const uint8_t* modes, uint8_t numSegments) {
+	if (r.numSlots == 0) {
+		return;
+	}
+	CapturedFrame& frame = getCapturedFrame(r, r.count);
+	frame.time = millis();
+	frame.length = min(size, r.frameBytes);
+	frame.numSegments = min(numSegments, (uint8_t)CAPTURE_MAX_SEGMENTS);
+	memcpy(frame.modes, modes, frame.numSegments);
+	memcpy(&frame + 1, pixels, frame.length);
+	__atomic_store_n(&r.count, r.count + 1, __ATOMIC_RELEASE);
+}
+
+// Range of captured frames, the oldest slot is left out as it may be overwritten while the frames are read
+void getCapturedFrames(const FrameRing& r, uint32_t& first, uint32_t& end) {
+	end = __atomic_load_n(&r.count, __ATOMIC_ACQUIRE);
+	first = end >= r.numSlots ? end - r.numSlots + 1 : 0;
+}
+
+// RGB of an LED in a frame, black past its end
+void getFrameRgb(const CapturedFrame& frame, uint32_t led, uint8_t rgb[3]) {
+	const uint8_t* pixels = getFramePixels(frame);
+	bool inside = led * 3 + 2 < frame.length;
+	rgb[0] = inside ? pixels[led * 3 + 1] : 0;
+	rgb[1] = inside ? pixels[led * 3] : 0;
+	rgb[2] = inside ? pixels[led * 3 + 2] : 0;
+}
+
+// PPM image with one row per frame
+void writeFramesPpm(PageWriter& out, const FrameRing& r) {
+	uint32_t first, end;
+	getCapturedFrames(r, first, end);
+	uint32_t width = r.frameBytes / 3;
+	out.printf("P6\n%u %u\n255\n", width, end - first);
+	for (uint32_t i = first; i < end; i++) {
+		const CapturedFrame& frame = getCapturedFrame(r, i);
+		for (uint32_t led = 0; led < width; led++) {
+			uint8_t rgb[3];
+			getFrameRgb(frame, led, rgb);
+			out.write((const char*)rgb, 3);
+		}
+	}
+}
+
+// One line per frame with time, segment modes and the LEDs as 24 bit terminal colours
+void writeFramesAnsi(PageWriter& out, const FrameRing& r) {
+	uint32_t first, end;
+	getCapturedFrames(r, first, end);
+	for (uint32_t i = first; i < end; i++) {
+		const CapturedFrame& frame = getCapturedFrame(r, i);
+		out.printf("%8u ", frame.time);
+		for (uint8_t s = 0; s < frame.numSegments; s++) {
+			if (s > 0) {
+				out.print(",");
+			}
+			out.print(frame.modes[s]);
+		}
+		out.print(" ");
+		for (uint32_t led = 0; led < frame.length / 3; led++) {
+			uint8_t rgb[3];
+			getFrameRgb(frame, led, rgb);
+			out.printf("\x1b[48;2;%u;%u;%um  ", rgb[0], rgb[1], rgb[2]);
+		}
+		out.print("\x1b[0m\n");
+	}
+}
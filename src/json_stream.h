@@ -0,0 +1,227 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Streaming JSON field reader
+ *
+ * Reads the top level members of a JSON object directly from a stream and copies the
+ * values of the requested keys into preallocated buffers. Nested values and all other
+ * members are skipped. No heap memory is used.
+ */
+#define JSON_STREAM_KEY_LEN 32
+
+struct JsonStreamField {
+	const char* key;
+	char* value;			// Destination buffer
+	size_t capacity;		// Size of the destination buffer, including the terminating zero
+	size_t length;			// Length of the value read
+	boolean found;			// Key was found in the object
+	boolean truncated;		// Value did not fit into the buffer and was cut
+};
+
+class JsonStreamReader {
+public:
+	JsonStreamReader(Stream& stream) : _stream(stream) {}
+
+	// Read the object, returns false if the stream is not a valid JSON object
+	boolean readFields(JsonStreamField* fields, uint8_t numFields) {
+		// Buffers are only written if their key is present
+		for (uint8_t i = 0; i < numFields; i++) {
+			fields[i].length = 0;
+			fields[i].found = false;
+			fields[i].truncated = false;
+		}
+
+		int c = next();
+		if (c != '{') {
+			return false;
+		}
+		c = next();
+		if (c == '}') {
+			return true;
+		}
+
+		char key[JSON_STREAM_KEY_LEN];
+		while (c == '"') {
+			size_t keyLength = 0;
+			boolean keyTruncated = false;
+			if (!readString(key, sizeof(key), keyLength, keyTruncated) || next() != ':') {
+				return false;
+			}
+
+			JsonStreamField* field = NULL;
+			for (uint8_t i = 0; i < numFields && !keyTruncated; i++) {
+				if (strcmp(key, fields[i].key) == 0) {
+					field = &fields[i];
+					break;
+				}
+			}
+
+			if (!readValue(field)) {
+				return false;
+			}
+
+			c = next();
+			if (c == '}') {
+				return true;
+			}
+			if (c != ',') {
+				return false;
+			}
+			c = next();
+		}
+		return false;
+	}
+
+private:
+	Stream& _stream;
+	int _peeked = -1;
+
+	// Read a single character, waits for the stream timeout
+	int read() {
+		if (_peeked >= 0) {
+			int c = _peeked;
+			_peeked = -1;
+			return c;
+		}
+		char c;
+		if (_stream.readBytes(&c, 1) != 1) {
+			return -1;
+		}
+		return (uint8_t)c;
+	}
+
+	// Read the next character that is not whitespace
+	int next() {
+		int c;
+		do {
+			c = read();
+		} while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+		return c;
+	}
+
+	// Store a character in the buffer if there is room left
+	static void append(char* buffer, size_t capacity, size_t& length, boolean& truncated, char c) {
+		if (buffer == NULL) {
+			return;
+		}
+		if (length + 1 < capacity) {
+			buffer[length++] = c;
+			buffer[length] = 0;
+		} else {
+			truncated = true;
+		}
+	}
+
+	// Read a string after its opening quote, buffer may be NULL to skip it
+	boolean readString(char* buffer, size_t capacity, size_t& length, boolean& truncated) {
+		length = 0;
+		if (buffer != NULL && capacity > 0) {
+			buffer[0] = 0;
+		}
+		for (;;) {
+			int c = read();
+			if (c < 0) {
+				return false;
+			}
+			if (c == '"') {
+				return true;
+			}
+			if (c == '\\') {
+				c = read();
+				switch (c) {
+					case 'b': c = '\b'; break;
+					case 'f': c = '\f'; break;
+					case 'n': c = '\n'; break;
+					case 'r': c = '\r'; break;
+					case 't': c = '\t'; break;
+					case 'u':
+						// Unicode escapes never occur in the values read here, keep a placeholder
+						for (uint8_t i = 0; i < 4; i++) {
+							if (read() < 0) {
+								return false;
+							}
+						}
+						c = '?';
+						break;
+					case -1: return false;
+				}
+			}
+			append(buffer, capacity, length, truncated, c);
+		}
+	}
+
+	// Read a number or literal (true, false, null)
+	boolean readLiteral(int c, char* buffer, size_t capacity, size_t& length, boolean& truncated) {
+		length = 0;
+		if (buffer != NULL && capacity > 0) {
+			buffer[0] = 0;
+		}
+		while (c >= 0 && c != ',' && c != '}' && c != ']' && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+			append(buffer, capacity, length, truncated, c);
+			c = read();
+		}
+		if (c < 0) {
+			return false;
+		}
+		_peeked = c;
+		return true;
+	}
+
+	// Skip a nested object or array after its opening bracket
+	boolean skipNested() {
+		uint8_t depth = 1;
+		while (depth > 0) {
+			int c = read();
+			if (c < 0) {
+				return false;
+			}
+			if (c == '{' || c == '[') {
+				depth++;
+			} else if (c == '}' || c == ']') {
+				depth--;
+			} else if (c == '"') {
+				size_t length;
+				boolean truncated;
+				if (!readString(NULL, 0, length, truncated)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Read a value and store it in the field (if given)
+	boolean readValue(JsonStreamField* field) {
+		char* buffer = field ? field->value : NULL;
+		size_t capacity = field ? field->capacity : 0;
+		size_t length = 0;
+		boolean truncated = false;
+		boolean success;
+
+		int c = next();
+		if (c == '"') {
+			success = readString(buffer, capacity, length, truncated);
+		} else if (c == '{' || c == '[') {
+			success = skipNested();
+		} else {
+			success = readLiteral(c, buffer, capacity, length, truncated);
+		}
+
+		if (field && success) {
+			field->found = true;
+			field->length = length;
+			field->truncated = truncated;
+		}
+		return success;
+	}
+};
@@ -0,0 +1,84 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * LED output
+ *
+ * Takes a frame rendered by WS2812FX through capture, crossfade and colour pipeline to the
+ * RMT driver. Kept apart from the LED task, so the host emulator sends its frames through
+ * the same path.
+ */
+uint32_t framesSent = 0;
+uint32_t framesSkipped = 0;
+uint32_t ledTransmitTime = 0;		// Transmit time of the last frame, measured in sendFrame()
+
+// Frames rendered by WS2812FX, served on /api/frames
+FrameRing frameCapture = {};
+#if LED_CAPTURE_BYTES > 0
+uint8_t frameCaptureMemory[LED_CAPTURE_BYTES];
+#endif
+
+// Size the capture slots for the current strip length, the frames captured so far are dropped
+void initFrameCapture(WS2812FX& fx) {
+#if LED_CAPTURE_BYTES > 0
+	initFrameRing(frameCapture, frameCaptureMemory, sizeof(frameCaptureMemory), fx.getNumBytes());
+#endif
+}
+
+// Keep the frame WS2812FX just rendered, with the modes of all its segments
+void captureFrame(FrameRing& r, WS2812FX& fx) {
+	uint8_t modes[CAPTURE_MAX_SEGMENTS];
+	uint8_t numSegments = min(fx.getNumSegments(), (uint8_t)CAPTURE_MAX_SEGMENTS);
+	for (uint8_t i = 0; i < numSegments; i++) {
+		modes[i] = fx.getMode(i);
+	}
+	captureFrame(r, fx.getPixels(), fx.getNumBytes(), modes, numSegments);
+}
+
+// Send the frame rendered by WS2812FX, repeat if it was sent before and did not change since
+void sendFrame(WS2812FX& fx, bool repeat) {
+	uint8_t *pixels = fx.getPixels();
+	if (!repeat) {
+		captureFrame(frameCapture, fx);
+	}
+	// numBytes is one more then the size of the ws2812fx's *pixels array.
+	// the extra byte is used by the driver to insert the LED reset pulse at the end.
+	uint16_t numBytes = fx.getNumBytes() + 1;
+	unsigned long tsTransmit = micros();
+	// send a corrected copy, so the next frame can be rendered while this one is transmitted
+	uint8_t *buffer = rmt_next_tx_buffer(numBytes);
+	if (buffer == NULL) {
+		// out of memory for this strip length, keep showing the last frame
+		framesSkipped++;
+		return;
+	}
+	// a crossfade changes the frame even if WS2812FX did not
+	repeat = repeat && !transitionActive();
+	if (transitionActive()) {
+		applyTransition(pixels, buffer, numBytes - 1);
+		pixels = buffer;
+		recordHistogram(metricLedTransition, micros() - tsTransmit);
+	}
+	unsigned long tsColor = micros();
+	applyColorPipeline(pixels, buffer, numBytes - 1, repeat);
+	recordHistogram(metricLedColor, micros() - tsColor);
+	// nothing to do if the frame did not change
+	if (rmt_tx_unchanged(numBytes - 1)) {
+		ledTransmitTime = micros() - tsTransmit;
+		framesSkipped++;
+		return;
+	}
+	rmt_write_tx_buffer(numBytes, fx.getNumBytes() / fx.getLength());
+	ledTransmitTime = micros() - tsTransmit;
+	recordHistogram(metricLedTransmit, ledTransmitTime);
+	framesSent++;
+}
@@ -0,0 +1,181 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Deferred logging
+ *
+ * LOG_ERROR() .. LOG_DEBUG() only store the format pointer and up to LOG_MAX_ARGS integer
+ * or pointer arguments in a lock-free ring buffer, a low priority task formats them and
+ * writes them to serial and to a text history that can be read via HTTP. Messages less
+ * severe than LOG_LEVEL are compiled out, as are the DBG_PRINT macros below LOG_LEVEL_DEBUG.
+ *
+ * Formats and string arguments are read when the message is drained, so they have to stay
+ * valid: use literals or global buffers, no String::c_str() and no floating point values.
+ */
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO				// Messages above this level are compiled out, LOG_LEVEL_DEBUG adds DBG_PRINT on serial (if not set via build flags)
+#endif
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 64						// Number of pending messages, power of two (if not set via build flags)
+#endif
+#ifndef LOG_HISTORY_SIZE
+#define LOG_HISTORY_SIZE 4096					// Size of the formatted log history served via HTTP (if not set via build flags)
+#endif
+#define LOG_MAX_ARGS 6
+#define LOG_LINE_LEN 192
+
+struct LogEntry {
+	uint32_t sequence;			// Ring buffer slot state
+	uint32_t time;				// Milliseconds since boot
+	const char* format;
+	uint32_t args[LOG_MAX_ARGS];
+	uint8_t level;
+};
+
+LogEntry logBuffer[LOG_BUFFER_SIZE];
+uint32_t logHead = 0;			// Next slot to write
+uint32_t logTail = 0;			// Next slot to drain, only used by the log task
+uint32_t logDropped = 0;		// Messages dropped because the buffer was full
+
+char logHistory[LOG_HISTORY_SIZE];
+uint32_t logHistoryEnd = 0;		// Number of bytes ever written to the history
+
+TaskHandle_t TaskLog = NULL;
+
+// Store a message, safe to call from any task. Fails if the buffer is full.
+bool logWrite(uint8_t level, const char* format, uint32_t a0 = 0, uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0, uint32_t a4 = 0, uint32_t a5 = 0) {
+	uint32_t pos = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+	LogEntry* entry;
+	for (;;) {
+		entry = &logBuffer[pos & (LOG_BUFFER_SIZE - 1)];
+		int32_t diff = (int32_t)(__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			// Slot is free, claim it (pos is updated if another task was faster)
+			if (__atomic_compare_exchange_n(&logHead, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			__atomic_fetch_add(&logDropped, 1, __ATOMIC_RELAXED);
+			return false;
+		} else {
+			pos = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+		}
+	}
+	entry->time = xTaskGetTickCount() * portTICK_PERIOD_MS;
+	entry->format = format;
+	entry->args[0] = a0;
+	entry->args[1] = a1;
+	entry->args[2] = a2;
+	entry->args[3] = a3;
+	entry->args[4] = a4;
+	entry->args[5] = a5;
+	entry->level = level;
+	__atomic_store_n(&entry->sequence, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+template<typename T> inline uint32_t logArg(T value) { return (uint32_t)value; }
+template<typename T> inline uint32_t logArg(T* value) { return (uint32_t)(uintptr_t)value; }
+
+template<typename... Args> inline void logMessage(uint8_t level, const char* format, Args... args) {
+	static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments");
+	logWrite(level, format, logArg(args)...);
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logMessage(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logMessage(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logMessage(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logMessage(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define DBG_PRINT(x) Serial.print(x)
+#define DBG_PRINTLN(x) Serial.println(x)
+#else
+#define LOG_DEBUG(...)
+#define DBG_PRINT(x)
+#define DBG_PRINTLN(x)
+#endif
+
+// Append a formatted line to the history, only called by the log task
+void appendLogHistory(const char* line, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		logHistory[(logHistoryEnd + i) % LOG_HISTORY_SIZE] = line[i];
+	}
+	__atomic_store_n(&logHistoryEnd, logHistoryEnd + length, __ATOMIC_RELEASE);
+}
+
+// Format and output the next pending message, returns false if there is none
+bool drainLog() {
+	LogEntry& entry = logBuffer[logTail & (LOG_BUFFER_SIZE - 1)];
+	if (__atomic_load_n(&entry.sequence, __ATOMIC_ACQUIRE) != logTail + 1) {
+		return false;
+	}
+
+	static const char levels[] = "-EWID";
+	char line[LOG_LINE_LEN];
+	int length = snprintf(line, sizeof(line), "[%6u][%c] ", entry.time, levels[entry.level]);
+	length += snprintf(line + length, sizeof(line) - length, entry.format, entry.args[0], entry.args[1], entry.args[2], entry.args[3], entry.args[4], entry.args[5]);
+	__atomic_store_n(&entry.sequence, logTail + LOG_BUFFER_SIZE, __ATOMIC_RELEASE);
+	logTail++;
+
+	length = min(length, (int)sizeof(line) - 1);
+	if (line[length - 1] != '\n') {
+		if (length == sizeof(line) - 1) {
+			length--;
+		}
+		line[length++] = '\n';
+	}
+	Serial.write((const uint8_t*)line, length);
+	appendLogHistory(line, length);
+	return true;
+}
+
+void logTask(void * parameter) {
+	for (;;) {
+		while (drainLog()) {
+		}
+		vTaskDelay(20 / portTICK_PERIOD_MS);
+	}
+}
+
+// Must be called before the first message is logged
+void initLogger() {
+	for (uint32_t i = 0; i < LOG_BUFFER_SIZE; i++) {
+		logBuffer[i].sequence = i;
+	}
+	// Lowest priority, on core 0 where the LED task leaves enough idle time
+	xTaskCreatePinnedToCore(
+		logTask,
+		"Log",
+		3000,
+		NULL,
+		0,
+		&TaskLog,
+		0);
+}
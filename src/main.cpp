@@ -20,22 +20,70 @@
 #include <EEPROM.h>
 #include "FS.h"
 #include "SPIFFS.h"
+#include "esp_freertos_hooks.h"
+#include "esp_timer.h"
+#include "rom/crc.h"
 #include "ESP32_RMT_Driver.h"
+#include "json_stream.h"
+#include "body_stream.h"
+#include "poll_scheduler.h"
+#include "token_schedule.h"
+#include "page_writer.h"
+#include "root_page.h"
+#include "metrics.h"
+#include "logger.h"
+#include "color_pipeline.h"
+#include "transition.h"
+#include "frame_capture.h"
+#include "led_output.h"
 
 
 // Global settings
 // #define NUMLEDS 16							// Number of LEDs on the strip (if not set via build flags)
 // #define DATAPIN 26							// GPIO pin used to drive the LED strip (20 == GPIO/D13) (if not set via build flags)
+#ifndef RMT_PINS
+#define RMT_PINS ""								// GPIO pins to split the strip across, e.g. "13,14", empty: DATAPIN only (if not set via build flags)
+#endif
 // #define DISABLECERTCHECK 1					// Uncomment to disable https certificate checks (if not set via build flags)
 // #define STATUS_PIN LED_BUILTIN				// User builtin LED for status (if not set via build flags)
 #define DEFAULT_POLLING_PRESENCE_INTERVAL "30"	// Default interval to poll for presence info (seconds)
+#define DEFAULT_POLLING_PRESENCE_INTERVAL_MAX "300"	// Default max interval to poll for presence info while nothing happens (seconds)
+#ifndef POLL_INTERVAL_FAST
+#define POLL_INTERVAL_FAST 10					// Interval to poll for presence info right after a change (if not set via build flags)
+#endif
+#define NTP_SERVER "pool.ntp.org"				// Time server, needed for working hours
 #define DEFAULT_ERROR_RETRY_INTERVAL 30			// Default interval to try again after errors
-#define TOKEN_REFRESH_TIMEOUT 60	 			// Number of seconds until expiration before token gets refreshed
-#define CONTEXT_FILE "/context.json"			// Filename of the context file
+#define CONTEXT_FILE "/context.json"			// Filename of the context file of older versions, migrated at boot
+#define CONTEXT_SLOT_A "/context_a.bin"			// Filenames of the two context slots
+#define CONTEXT_SLOT_B "/context_b.bin"
+#define CONTEXT_MAGIC 0x43505445				// "ETPC"
+#define CONTEXT_VERSION 1						// Version of the binary context format
 #define VERSION "0.18.1"						// Version of the software
-
-#define DBG_PRINT(x) Serial.print(x)
-#define DBG_PRINTLN(x) Serial.println(x)
+#ifndef GRAPH_API_HOST
+#define GRAPH_API_HOST "graph.microsoft.com"	// Graph API host, may point to a local mock together with DISABLECERTCHECK (if not set via build flags)
+#endif
+#ifndef LED_FPS
+#define LED_FPS 100								// Target frame rate of the LED task (if not set via build flags)
+#endif
+#ifndef LED_TASK_STACK
+#define LED_TASK_STACK 4096						// Stack size of the LED task, WS2812FX modes and the frame pipeline run on it (if not set via build flags)
+#endif
+#define LED_TASK_STACK_LOW 512					// Free LED task stack below which a warning is logged
+#define LED_WIRE_TIME_PER_LED 30				// Time to send one LED at 800 kHz (us)
+#define LED_WIRE_TIME_RESET 50					// Reset pulse at the end of a frame (us)
+#define MAX_USERS 8								// Maximum number of users on a team board
+#define USER_ID_LEN 37							// Length of a user id (GUID) including terminating zero
+
+// #define DISCARD_ID_TOKEN 1					// Uncomment to not keep the id token, it is not needed to poll presence (if not set via build flags)
+#ifndef ACCESS_TOKEN_LEN
+#define ACCESS_TOKEN_LEN 3072					// Token arena space for the access token (if not set via build flags)
+#endif
+#ifndef REFRESH_TOKEN_LEN
+#define REFRESH_TOKEN_LEN 2048					// Token arena space for the refresh token (if not set via build flags)
+#endif
+#ifndef ID_TOKEN_LEN
+#define ID_TOKEN_LEN 2048						// Token arena space for the id token (if not set via build flags)
+#endif
 
 
 #ifndef DISABLECERTCHECK
@@ -118,21 +166,37 @@ IotWebConf iotWebConf(thingName, &dnsServer, &server, wifiInitialApPassword);
 char paramClientIdValue[STRING_LEN];
 char paramTenantValue[STRING_LEN];
 char paramPollIntervalValue[INTEGER_LEN];
+char paramPollIntervalMaxValue[INTEGER_LEN];
+char paramWorkingHoursValue[INTEGER_LEN];
+char paramTimezoneValue[STRING_LEN];
 char paramNumLedsValue[INTEGER_LEN];
+char paramSegmentsValue[STRING_LEN];
+char paramBrightnessValue[INTEGER_LEN];
+char paramColorTemperatureValue[INTEGER_LEN];
+char paramUsersValue[MAX_USERS * USER_ID_LEN];
 IotWebConfSeparator separator = IotWebConfSeparator();
 IotWebConfParameter paramClientId = IotWebConfParameter("Client-ID (Generic ID: 3837bbf0-30fb-47ad-bce8-f460ba9880c3)", "clientId", paramClientIdValue, STRING_LEN, "text", "e.g. 3837bbf0-30fb-47ad-bce8-f460ba9880c3", "3837bbf0-30fb-47ad-bce8-f460ba9880c3");
 IotWebConfParameter paramTenant = IotWebConfParameter("Tenant hostname / ID", "tenantId", paramTenantValue, STRING_LEN, "text", "e.g. contoso.onmicrosoft.com");
 IotWebConfParameter paramPollInterval = IotWebConfParameter("Presence polling interval (sec) (default: 30)", "pollInterval", paramPollIntervalValue, INTEGER_LEN, "number", "10..300", DEFAULT_POLLING_PRESENCE_INTERVAL, "min='10' max='300' step='5'");
+IotWebConfParameter paramPollIntervalMax = IotWebConfParameter("Max. presence polling interval outside working hours / offline (sec) (default: 300)", "pollIntervalMax", paramPollIntervalMaxValue, INTEGER_LEN, "number", "10..3600", DEFAULT_POLLING_PRESENCE_INTERVAL_MAX, "min='10' max='3600' step='5'");
+IotWebConfParameter paramWorkingHours = IotWebConfParameter("Working hours (e.g. 8-18, empty: always)", "workingHours", paramWorkingHoursValue, INTEGER_LEN, "text", "e.g. 8-18", "");
+IotWebConfParameter paramTimezone = IotWebConfParameter("Timezone (POSIX TZ, e.g. CET-1CEST,M3.5.0,M10.5.0/3)", "timezone", paramTimezoneValue, STRING_LEN, "text", "e.g. CET-1CEST,M3.5.0,M10.5.0/3", "UTC0");
 IotWebConfParameter paramNumLeds = IotWebConfParameter("Number of LEDs (default: 16)", "numLeds", paramNumLedsValue, INTEGER_LEN, "number", "1..500", "16", "min='1' max='500' step='1'");
+IotWebConfParameter paramSegments = IotWebConfParameter("LED segments (comma separated lengths, last one shows status if more than one)", "segments", paramSegmentsValue, STRING_LEN, "text", "e.g. 12,4", "");
+IotWebConfParameter paramBrightness = IotWebConfParameter("LED brightness (%) (default: 20)", "brightness", paramBrightnessValue, INTEGER_LEN, "number", "1..100", DEFAULT_COLOR_BRIGHTNESS, "min='1' max='100' step='1'");
+IotWebConfParameter paramColorTemperature = IotWebConfParameter("LED colour temperature (K) (default: 6500, lower is warmer)", "colorTemperature", paramColorTemperatureValue, INTEGER_LEN, "number", "1900..10000", DEFAULT_COLOR_TEMPERATURE, "min='1900' max='10000' step='100'");
+IotWebConfParameter paramUsers = IotWebConfParameter("Team board user IDs (comma separated, max. 8, one segment per user, needs Presence.Read.All)", "users", paramUsersValue, MAX_USERS * USER_ID_LEN, "text", "e.g. 3837bbf0-30fb-47ad-bce8-f460ba9880c3,...", "");
 byte lastIotWebConfState;
 
-// HTTP client
-WiFiClientSecure client;
-
 // WS2812FX
 WS2812FX ws2812fx = WS2812FX(NUMLEDS, DATAPIN, NEO_GRB + NEO_KHZ800);
 int numberLeds;
 
+// LED segments: segment 0 shows presence, the last one shows status (if more than one is configured)
+uint8_t numberSegments = 1;
+uint16_t segmentStart[MAX_NUM_SEGMENTS] = { 0 };
+uint16_t segmentLength[MAX_NUM_SEGMENTS] = { NUMLEDS };
+
 // OTA update
 HTTPUpdateServer httpUpdater;
 
@@ -141,13 +205,38 @@ String user_code = "";
 String device_code = "";
 uint8_t interval = 5;
 
-String access_token = "";
-String refresh_token = "";
-String id_token = "";
-unsigned int expires = 0;
-
-String availability = "";
-String activity = "";
+// Token arena: all tokens are kept in one buffer that is allocated once at boot. Every token
+// has a second buffer that receives a new token while the current one stays in use.
+#define TOKEN_ACCESS 0
+#define TOKEN_REFRESH 1
+#define TOKEN_ID 2
+#define NUM_TOKENS 3
+struct TokenSlot {
+	char* value;		// Current token
+	char* staging;		// New token while it is read from a response
+	size_t capacity;
+	size_t highWater;
+};
+TokenSlot tokenSlots[NUM_TOKENS];
+char* tokenArena = NULL;
+size_t tokenArenaSize = 0;
+
+char* access_token = NULL;
+char* refresh_token = NULL;
+char* id_token = NULL;
+TokenSchedule tokenSchedule = {};	// Expiry of the access token and next background refresh
+
+#define PRESENCE_LEN 32
+char availability[PRESENCE_LEN] = "";
+char activity[PRESENCE_LEN] = "";
+char presenceErrorCode[PRESENCE_LEN] = "";
+
+// Team board: presence of these users is shown on segments 0..n-1 instead of the own presence
+char userIds[MAX_USERS][USER_ID_LEN];
+uint8_t numberUsers = 0;
+char userAvailability[MAX_USERS][PRESENCE_LEN];	// Copies of the last response, the deferred logger reads them later
+char userActivity[MAX_USERS][PRESENCE_LEN];
+String teamPresencePayload = "";
 
 // Statemachine
 #define SMODEINITIAL 0               // Initial
@@ -161,38 +250,392 @@ String activity = "";
 #define SMODEPRESENCEREQUESTERROR 23 // Access token needs refresh
 uint8_t state = SMODEINITIAL;
 uint8_t laststate = SMODEINITIAL;
-static unsigned long tsPolling = 0;
+static uint64_t tsPolling = 0;
 uint8_t retries = 0;
 
+// Presence polling
+PollScheduler pollScheduler;
+boolean presenceChanged = false;
+
 // Multicore
-TaskHandle_t TaskNeopixel; 
+TaskHandle_t TaskNeopixel = NULL;
+
+// LED statistics
+uint32_t ledFrames = 0;				// Frames scheduled by the LED task
+uint32_t ledOverruns = 0;			// Frames that took longer than their budget
+uint32_t ledFramesDropped = 0;		// Frame slots missed because of overruns
+uint32_t ledJitterMax = 0;			// Largest deviation of a frame period from the budget (us)
+uint32_t ledFrameBudget = 0;		// Current frame period (ms)
+uint16_t ledFps = 0;				// Frames scheduled during the last second
+uint32_t ledFramesLast = 0;
+uint32_t ledStackFree = 0;			// Least free stack of the LED task so far (bytes)
+volatile uint32_t idleTicks[portNUM_PROCESSORS];		// Ticks that interrupted the idle task
+volatile uint32_t totalTicks[portNUM_PROCESSORS];
+uint32_t idleTicksLast[portNUM_PROCESSORS];
+uint32_t totalTicksLast[portNUM_PROCESSORS];
+uint8_t idlePercent[portNUM_PROCESSORS];
+unsigned long tsIdleStats = 0;
+
+// Loop statistics
+uint32_t loopMaxTime = 0;
 
 
 /**
  * Helper
  */
+// Milliseconds since boot, 64 bit so deadlines never wrap
+uint64_t uptimeMs() {
+	return esp_timer_get_time() / 1000;
+}
+
 // Calculate token lifetime
 int getTokenLifetime() {
-	return (expires - millis()) / 1000;
+	return getTokenLifetime(tokenSchedule, uptimeMs());
+}
+
+// Split the strip into the configured segments, e.g. "12,4". Without configuration one segment spans the whole strip.
+void initSegments() {
+	numberSegments = 0;
+	uint16_t start = 0;
+	const char* p = paramSegmentsValue;
+	while (*p && numberSegments < MAX_NUM_SEGMENTS && start < numberLeds) {
+		char* end;
+		long length = strtol(p, &end, 10);
+		if (end == p || length < 1) {
+			break;
+		}
+		segmentStart[numberSegments] = start;
+		segmentLength[numberSegments] = min(length, (long)(numberLeds - start));
+		start += segmentLength[numberSegments];
+		numberSegments++;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	if (numberSegments == 0) {
+		segmentStart[0] = 0;
+		segmentLength[0] = numberLeds;
+		numberSegments = 1;
+	}
+
+	resetTransitions();
+	ws2812fx.resetSegments();
+	for (uint8_t i = 0; i < numberSegments; i++) {
+		ws2812fx.setSegment(i, segmentStart[i], segmentStart[i] + segmentLength[i] - 1, FX_MODE_STATIC, WHITE, 3000, false);
+		Serial.printf("initSegments: %d, %d-%d\n", i, segmentStart[i], segmentStart[i] + segmentLength[i] - 1);
+	}
+	if (TaskNeopixel != NULL) {
+		xTaskNotifyGive(TaskNeopixel);
+	}
+}
+
+// Build the colour tables from the configured brightness and colour temperature
+void initColorPipeline() {
+	int brightness = atoi(paramBrightnessValue);
+	if (brightness < 1 || brightness > 100) {
+		brightness = atoi(DEFAULT_COLOR_BRIGHTNESS);
+	}
+	int kelvin = atoi(paramColorTemperatureValue);
+	if (kelvin < 1900 || kelvin > 10000) {
+		kelvin = COLOR_TEMPERATURE_NEUTRAL;
+	}
+	buildColorLut(brightness, kelvin);
+	Serial.printf("initColorPipeline: %d%%, %dK\n", brightness, kelvin);
+	if (TaskNeopixel != NULL) {
+		xTaskNotifyGive(TaskNeopixel);
+	}
+}
+
+// Read the configured user ids, e.g. "id1, id2", and prepare the request body for the team presence
+void initUsers() {
+	numberUsers = 0;
+	teamPresencePayload = "{\"ids\":[";
+	const char* p = paramUsersValue;
+	while (*p && numberUsers < MAX_USERS) {
+		while (*p == ' ' || *p == ',') {
+			p++;
+		}
+		size_t length = 0;
+		while (p[length] && p[length] != ',' && p[length] != ' ') {
+			length++;
+		}
+		if (length == 0) {
+			break;
+		}
+		if (length < USER_ID_LEN) {
+			strlcpy(userIds[numberUsers], p, length + 1);
+			if (numberUsers > 0) {
+				teamPresencePayload += ",";
+			}
+			teamPresencePayload += "\"" + String(userIds[numberUsers]) + "\"";
+			numberUsers++;
+		} else {
+			DBG_PRINTLN(F("initUsers() - Ignoring invalid user id"));
+		}
+		p += length;
+	}
+	teamPresencePayload += "]}";
+	Serial.printf("initUsers: %d users\n", numberUsers);
+}
+
+// Index of the user with the given id, -1 if not configured
+int8_t getUserIndex(const char* id) {
+	for (uint8_t i = 0; i < numberUsers; i++) {
+		if (strcasecmp(userIds[i], id) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Set up polling intervals and working hours from the settings
+void initPolling() {
+	int workStart = 0;
+	int workEnd = 0;
+	if (sscanf(paramWorkingHoursValue, "%d-%d", &workStart, &workEnd) != 2 || workStart < 0 || workStart > 23 || workEnd < 0 || workEnd > 24) {
+		workStart = workEnd = 0;
+	}
+	initPollScheduler(pollScheduler, POLL_INTERVAL_FAST, max(atoi(paramPollIntervalValue), 10), max(atoi(paramPollIntervalMaxValue), 10), workStart, workEnd % 24);
+}
+
+// Current local hour, -1 if time is not synced yet
+int8_t getCurrentHour() {
+	struct tm timeinfo;
+	if (!getLocalTime(&timeinfo, 0)) {
+		return -1;
+	}
+	return timeinfo.tm_hour;
+}
+
+// Allocate the token arena and split it into the token slots, returns false if out of memory
+boolean initTokenArena() {
+	tokenSlots[TOKEN_ACCESS].capacity = ACCESS_TOKEN_LEN;
+	tokenSlots[TOKEN_REFRESH].capacity = REFRESH_TOKEN_LEN;
+	#ifdef DISCARD_ID_TOKEN
+	tokenSlots[TOKEN_ID].capacity = 0;
+	#else
+	tokenSlots[TOKEN_ID].capacity = ID_TOKEN_LEN;
+	#endif
+
+	tokenArenaSize = 0;
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		tokenArenaSize += 2 * tokenSlots[i].capacity;
+	}
+	tokenArena = (char*)calloc(tokenArenaSize, 1);
+	if (tokenArena == NULL) {
+		Serial.printf("initTokenArena() - ERROR Unable to allocate %d bytes\n", tokenArenaSize);
+		return false;
+	}
+
+	size_t offset = 0;
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		tokenSlots[i].value = tokenSlots[i].capacity > 0 ? tokenArena + offset : NULL;
+		tokenSlots[i].staging = tokenSlots[i].capacity > 0 ? tokenArena + offset + tokenSlots[i].capacity : NULL;
+		tokenSlots[i].highWater = 0;
+		offset += 2 * tokenSlots[i].capacity;
+	}
+	access_token = tokenSlots[TOKEN_ACCESS].value;
+	refresh_token = tokenSlots[TOKEN_REFRESH].value;
+	id_token = tokenSlots[TOKEN_ID].value;
+	Serial.printf("initTokenArena() - %d bytes\n", tokenArenaSize);
+	return true;
 }
 
-// Save context information to file in SPIFFS
+// Update the high-water marks after tokens were written
+void updateTokenArenaUsage() {
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		if (tokenSlots[i].value != NULL) {
+			size_t used = strlen(tokenSlots[i].value) + 1;
+			if (used > tokenSlots[i].highWater) {
+				tokenSlots[i].highWater = used;
+			}
+		}
+	}
+}
+
+// Sum of the high-water marks of all token slots
+size_t getTokenArenaHighWater() {
+	size_t highWater = 0;
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		highWater += tokenSlots[i].highWater;
+	}
+	return highWater;
+}
+
+// Copy token into its slot, fails if it does not fit. Discarded tokens are accepted and dropped.
+boolean storeToken(uint8_t slot, const char* src) {
+	if (tokenSlots[slot].capacity == 0) {
+		return true;
+	}
+	if (src == NULL || strlen(src) >= tokenSlots[slot].capacity) {
+		return false;
+	}
+	strcpy(tokenSlots[slot].value, src);
+	return true;
+}
+
+// Field to read a token from a response into the staging buffer of its slot
+JsonStreamField tokenField(const char* key, uint8_t slot) {
+	JsonStreamField field = { key, tokenSlots[slot].staging, tokenSlots[slot].capacity };
+	return field;
+}
+
+// Make the tokens read into the staging buffers current, tokens missing in the response are kept.
+// Each token is switched with a single pointer store, a request never sees a partially written token.
+void commitTokens(const JsonStreamField* fields) {
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		if (fields[i].found && tokenSlots[i].capacity > 0) {
+			char* value = tokenSlots[i].staging;
+			tokenSlots[i].staging = tokenSlots[i].value;
+			tokenSlots[i].value = value;
+		}
+	}
+	access_token = tokenSlots[TOKEN_ACCESS].value;
+	refresh_token = tokenSlots[TOKEN_REFRESH].value;
+	id_token = tokenSlots[TOKEN_ID].value;
+	updateTokenArenaUsage();
+}
+
+// Token was completely read from a response (or is not kept at all)
+boolean tokenFieldValid(const JsonStreamField& field) {
+	if (field.capacity == 0) {
+		return true;
+	}
+	return field.found && !field.truncated && field.length > 0;
+}
+
+// Binary context file: header followed by the length prefixed tokens. The context is written
+// alternately to two slots, so a failed write always leaves the previous context intact.
+struct ContextHeader {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t numTokens;
+	uint16_t reserved;
+	uint32_t sequence;	// Incremented with every write, the newest valid slot wins
+	uint32_t length;	// Length of the token data
+	uint32_t crc;		// CRC32 of the token data
+};
+const char* const contextSlots[2] = { CONTEXT_SLOT_A, CONTEXT_SLOT_B };
+int8_t contextSlot = -1;		// Slot holding the current context, -1 if none
+uint32_t contextSequence = 0;	// Number of writes since the context was created
+uint32_t contextCrc = 0;
+
+// Context statistics
+uint32_t contextWrites = 0;
+uint32_t contextWritesSkipped = 0;
+uint32_t contextLoadTime = 0;
+
+// File index of the web server (spiffs_webserver.h), context files are served too
+void updateFileIndex(String path);
+
+uint16_t getContextTokenLength(uint8_t slot) {
+	return tokenSlots[slot].value != NULL ? strlen(tokenSlots[slot].value) : 0;
+}
+
+// Save context information to file in SPIFFS, if it changed
 void saveContext() {
-	const size_t capacity = JSON_OBJECT_SIZE(3) + 5000;
-	DynamicJsonDocument contextDoc(capacity);
-	contextDoc["access_token"] = access_token.c_str();
-	contextDoc["refresh_token"] = refresh_token.c_str();
-	contextDoc["id_token"] = id_token.c_str();
-
-	File contextFile = SPIFFS.open(CONTEXT_FILE, FILE_WRITE);
-	size_t bytesWritten = serializeJsonPretty(contextDoc, contextFile);
+	uint32_t crc = 0;
+	uint32_t length = 0;
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		uint16_t tokenLength = getContextTokenLength(i);
+		crc = crc32_le(crc, (const uint8_t*)&tokenLength, sizeof(tokenLength));
+		crc = crc32_le(crc, (const uint8_t*)tokenSlots[i].value, tokenLength);
+		length += sizeof(tokenLength) + tokenLength;
+	}
+	if (contextSlot >= 0 && crc == contextCrc) {
+		contextWritesSkipped++;
+		DBG_PRINTLN(F("saveContext() - Unchanged"));
+		return;
+	}
+
+	uint8_t slot = contextSlot == 0 ? 1 : 0;
+	ContextHeader header = { CONTEXT_MAGIC, CONTEXT_VERSION, NUM_TOKENS, 0, contextSequence + 1, length, crc };
+	File contextFile = SPIFFS.open(contextSlots[slot], FILE_WRITE);
+	size_t bytesWritten = contextFile.write((const uint8_t*)&header, sizeof(header));
+	for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+		uint16_t tokenLength = getContextTokenLength(i);
+		bytesWritten += contextFile.write((const uint8_t*)&tokenLength, sizeof(tokenLength));
+		bytesWritten += contextFile.write((const uint8_t*)tokenSlots[i].value, tokenLength);
+	}
 	contextFile.close();
+	updateFileIndex(contextSlots[slot]);
+
+	if (bytesWritten != sizeof(header) + length) {
+		// The other slot still holds the previous context
+		DBG_PRINTLN(F("saveContext() - Write failed"));
+		return;
+	}
+	contextSlot = slot;
+	contextSequence = header.sequence;
+	contextCrc = crc;
+	contextWrites++;
 	DBG_PRINT(F("saveContext() - Success: "));
 	DBG_PRINTLN(bytesWritten);
-	// DBG_PRINTLN(contextDoc.as<String>());
 }
 
-boolean loadContext() {
+// Sequence number of a valid context slot, 0 if there is none
+uint32_t readContextSequence(uint8_t slot) {
+	File file = SPIFFS.open(contextSlots[slot]);
+	ContextHeader header;
+	if (!file || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+		return 0;
+	}
+	file.close();
+	if (header.magic != CONTEXT_MAGIC || header.version != CONTEXT_VERSION || header.numTokens != NUM_TOKENS) {
+		return 0;
+	}
+	return header.sequence;
+}
+
+// Read the tokens of a context slot directly into the token arena
+boolean loadContextSlot(uint8_t slot) {
+	File file = SPIFFS.open(contextSlots[slot]);
+	ContextHeader header;
+	if (!file || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+		return false;
+	}
+
+	uint32_t crc = 0;
+	uint32_t length = 0;
+	boolean success = true;
+	for (uint8_t i = 0; i < NUM_TOKENS && success; i++) {
+		uint16_t tokenLength;
+		success = file.read((uint8_t*)&tokenLength, sizeof(tokenLength)) == sizeof(tokenLength);
+		crc = crc32_le(crc, (const uint8_t*)&tokenLength, sizeof(tokenLength));
+		length += sizeof(tokenLength) + tokenLength;
+		if (!success) {
+			break;
+		}
+
+		if (tokenSlots[i].capacity == 0) {
+			// Discarded token, only needed for the CRC
+			uint8_t buffer[64];
+			for (uint16_t remaining = tokenLength; remaining > 0 && success; ) {
+				size_t chunk = min(remaining, (uint16_t)sizeof(buffer));
+				success = file.read(buffer, chunk) == chunk;
+				crc = crc32_le(crc, buffer, chunk);
+				remaining -= chunk;
+			}
+		} else if (tokenLength < tokenSlots[i].capacity) {
+			success = file.read((uint8_t*)tokenSlots[i].value, tokenLength) == tokenLength;
+			tokenSlots[i].value[tokenLength] = 0;
+			crc = crc32_le(crc, (const uint8_t*)tokenSlots[i].value, tokenLength);
+		} else {
+			success = false;
+		}
+	}
+	file.close();
+
+	if (!success || length != header.length || crc != header.crc) {
+		Serial.printf("loadContext() - Slot %d damaged\n", slot);
+		return false;
+	}
+	contextSlot = slot;
+	contextSequence = header.sequence;
+	contextCrc = crc;
+	return true;
+}
+
+// Read context from the JSON file of older versions
+boolean loadLegacyContext() {
 	File file = SPIFFS.open(CONTEXT_FILE);
 	boolean success = false;
 
@@ -212,31 +655,20 @@ boolean loadContext() {
 				DBG_PRINTLN(err.c_str());
 			} else {
 				int numSettings = 0;
-				if (!contextDoc["access_token"].isNull()) {
-					access_token = contextDoc["access_token"].as<String>();
+				if (storeToken(TOKEN_ACCESS, contextDoc["access_token"])) {
 					numSettings++;
 				}
-				if (!contextDoc["refresh_token"].isNull()) {
-					refresh_token = contextDoc["refresh_token"].as<String>();
+				if (storeToken(TOKEN_REFRESH, contextDoc["refresh_token"])) {
 					numSettings++;
 				}
-				if (!contextDoc["id_token"].isNull()){
-					id_token = contextDoc["id_token"].as<String>();
+				if (storeToken(TOKEN_ID, contextDoc["id_token"])) {
 					numSettings++;
 				}
 				if (numSettings == 3) {
 					success = true;
-					DBG_PRINTLN(F("loadContext() - Success"));
-					if (strlen(paramClientIdValue) > 0 && strlen(paramTenantValue) > 0) {
-						DBG_PRINTLN(F("loadContext() - Next: Refresh token."));
-						state = SMODEREFRESHTOKEN;
-					} else {
-						DBG_PRINTLN(F("loadContext() - No client id or tenant setting found."));
-					}
 				} else {
 					Serial.printf("loadContext() - ERROR Number of valid settings in file: %d, should be 3.\n", numSettings);
 				}
-				// DBG_PRINTLN(contextDoc.as<String>());
 			}
 		}
 		file.close();
@@ -245,9 +677,54 @@ boolean loadContext() {
 	return success;
 }
 
-// Remove context information file in SPIFFS
+boolean loadContext() {
+	unsigned long tsStart = micros();
+	boolean success = false;
+
+	uint32_t sequence[2] = { readContextSequence(0), readContextSequence(1) };
+	if (sequence[0] > 0 || sequence[1] > 0) {
+		// Newest slot first, the other one is the fallback if it is damaged
+		uint8_t newest = sequence[1] > sequence[0] ? 1 : 0;
+		success = loadContextSlot(newest) || (sequence[1 - newest] > 0 && loadContextSlot(1 - newest));
+		if (!success) {
+			for (uint8_t i = 0; i < NUM_TOKENS; i++) {
+				storeToken(i, "");
+			}
+		}
+	} else if (loadLegacyContext()) {
+		// Migrate to the binary format
+		success = true;
+		saveContext();
+		SPIFFS.remove(CONTEXT_FILE);
+		updateFileIndex(CONTEXT_FILE);
+		DBG_PRINTLN(F("loadContext() - Migrated legacy context"));
+	}
+	contextLoadTime = micros() - tsStart;
+	updateTokenArenaUsage();
+
+	if (success) {
+		Serial.printf("loadContext() - Success, sequence %u, %u us\n", contextSequence, contextLoadTime);
+		if (strlen(paramClientIdValue) > 0 && strlen(paramTenantValue) > 0) {
+			DBG_PRINTLN(F("loadContext() - Next: Refresh token."));
+			state = SMODEREFRESHTOKEN;
+		} else {
+			DBG_PRINTLN(F("loadContext() - No client id or tenant setting found."));
+		}
+	}
+
+	return success;
+}
+
+// Remove context information files in SPIFFS
 void removeContext() {
+	SPIFFS.remove(CONTEXT_SLOT_A);
+	SPIFFS.remove(CONTEXT_SLOT_B);
 	SPIFFS.remove(CONTEXT_FILE);
+	updateFileIndex(CONTEXT_SLOT_A);
+	updateFileIndex(CONTEXT_SLOT_B);
+	updateFileIndex(CONTEXT_FILE);
+	contextSlot = -1;
+	contextSequence = 0;
 	DBG_PRINTLN(F("removeContext() - Success"));
 }
 
@@ -270,56 +747,86 @@ void startMDNS() {
 
 #include "request_handler.h"
 #include "spiffs_webserver.h"
+#include "activity.h"
+#include "animation_table.h"
+#include "presence_animation.h"
 
 
 // Neopixel control
 void setAnimation(uint8_t segment, uint8_t mode = FX_MODE_STATIC, uint32_t color = RED, uint16_t speed = 3000, bool reverse = false) {
-	uint16_t startLed, endLed = 0;
-
-	// Support only one segment for the moment
-	if (segment == 0) {
-		startLed = 0;
-		endLed = numberLeds;
+	if (segment >= numberSegments) {
+		return;
+	}
+	uint16_t startLed = segmentStart[segment];
+	uint16_t endLed = startLed + segmentLength[segment] - 1;
+	LOG_DEBUG("setAnimation: %d, %d-%d, Mode: %d, Color: %d, Speed: %d", segment, startLed, endLed, mode, color, speed);
+	if (ws2812fx.getMode(segment) != mode || ws2812fx.getColor(segment) != color || ws2812fx.getSpeed(segment) != speed) {
+		startTransition(segment, startLed, endLed, ws2812fx.getPixels());
 	}
-	Serial.printf("setAnimation: %d, %d-%d, Mode: %d, Color: %d, Speed: %d\n", segment, startLed, endLed, mode, color, speed);
 	ws2812fx.setSegment(segment, startLed, endLed, mode, color, speed, reverse);
-}
+	// Render with the next service() call, a static segment would only be drawn again after its speed
+	ws2812fx.trigger();
 
-void setPresenceAnimation() {
-	// Activity: Available, Away, BeRightBack, Busy, DoNotDisturb, InACall, InAConferenceCall, Inactive, InAMeeting, Offline, OffWork, OutOfOffice, PresenceUnknown, Presenting, UrgentInterruptionsOnly
-
-	if (activity.equals("Available")) {
-		setAnimation(0, FX_MODE_STATIC, GREEN);
-	}
-	if (activity.equals("Away")) {
-		setAnimation(0, FX_MODE_STATIC, YELLOW);
-	}
-	if (activity.equals("BeRightBack")) {
-		setAnimation(0, FX_MODE_STATIC, ORANGE);
+	// Wake up neopixel task, it may be waiting while a static color is shown
+	if (TaskNeopixel != NULL) {
+		xTaskNotifyGive(TaskNeopixel);
 	}
-	if (activity.equals("Busy")) {
-		setAnimation(0, FX_MODE_STATIC, PURPLE);
-	}
-	if (activity.equals("DoNotDisturb") || activity.equals("UrgentInterruptionsOnly")) {
-		setAnimation(0, FX_MODE_STATIC, PINK);
-	}
-	if (activity.equals("InACall")) {
-		setAnimation(0, FX_MODE_BREATH, RED);
+}
+
+void setPresenceAnimation(uint8_t segment, Activity id) {
+	if (id != ACTIVITY_UNKNOWN) {
+		const PresenceAnimation& a = presenceAnimations[id];
+		setAnimation(segment, a.mode, a.color, a.speed);
 	}
-	if (activity.equals("InAConferenceCall")) {
-		setAnimation(0, FX_MODE_BREATH, RED, 9000);
+}
+
+// Current activity per user (or of the own presence)
+Activity currentActivity[MAX_USERS] = { ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN, ACTIVITY_UNKNOWN };
+
+// Show new activity of a user, remember if it changed
+void updatePresence(uint8_t user, const char* _activity) {
+	// Activity: Available, Away, BeRightBack, Busy, DoNotDisturb, InACall, InAConferenceCall, Inactive, InAMeeting, Offline, OffWork, OutOfOffice, PresenceUnknown, Presenting, UrgentInterruptionsOnly
+	Activity id = getActivity(_activity);
+	if (id != currentActivity[user]) {
+		currentActivity[user] = id;
+		presenceChanged = true;
 	}
-	if (activity.equals("Inactive")) {
-		setAnimation(0, FX_MODE_BREATH, WHITE);
+	setPresenceAnimation(user, id);
+}
+
+// Nobody is around
+boolean isEverybodyOffline() {
+	for (uint8_t i = 0; i < max(numberUsers, (uint8_t)1); i++) {
+		if (!isOfflineActivity(currentActivity[i])) {
+			return false;
+		}
 	}
-	if (activity.equals("InAMeeting")) {
-		setAnimation(0, FX_MODE_SCAN, RED);
-	}	
-	if (activity.equals("Offline") || activity.equals("OffWork") || activity.equals("OutOfOffice") || activity.equals("PresenceUnknown")) {
-		setAnimation(0, FX_MODE_STATIC, BLACK);
+	return true;
+}
+
+// Show token health on the status segment (last segment, if there is one left after the presence segments)
+void setStatusAnimation() {
+	if (numberSegments <= max(numberUsers, (uint8_t)1)) {
+		return;
 	}
-	if (activity.equals("Presenting")) {
-		setAnimation(0, FX_MODE_COLOR_WIPE, RED);
+	uint8_t segment = numberSegments - 1;
+	switch (state) {
+		case SMODEAUTHREADY:
+		case SMODEPOLLPRESENCE:
+			setAnimation(segment, FX_MODE_STATIC, retries > 0 ? ORANGE : GREEN);
+			break;
+		case SMODEREFRESHTOKEN:
+			setAnimation(segment, FX_MODE_BREATH, YELLOW);
+			break;
+		case SMODEDEVICELOGINSTARTED:
+			setAnimation(segment, FX_MODE_BREATH, PURPLE);
+			break;
+		case SMODEDEVICELOGINFAILED:
+		case SMODEPRESENCEREQUESTERROR:
+			setAnimation(segment, FX_MODE_STATIC, RED);
+			break;
+		default:
+			setAnimation(segment, FX_MODE_STATIC, BLUE);
 	}
 }
 
@@ -333,113 +840,219 @@ void onWifiConnected() {
 	state = SMODEWIFICONNECTED;
 }
 
-// Poll for access token
-void pollForToken() {
-	String payload = "client_id=" + String(paramClientIdValue) + "&grant_type=urn:ietf:params:oauth:grant-type:device_code&device_code=" + device_code;
-	Serial.printf("pollForToken()\n");
+// Token response, written by the network task
+char tokenExpiresIn[16];
+char tokenError[64];
+char tokenErrorDescription[256];
+JsonStreamField tokenFields[6];
 
-	// const size_t capacity = JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(7) + 530; // Case 1: HTTP 400 error (not yet ready)
-	const size_t capacity = JSON_OBJECT_SIZE(7) + 10000; // Case 2: Successful (bigger size of both variants, so take that one as capacity)
-	DynamicJsonDocument responseDoc(capacity);
-	boolean res = requestJsonApi(responseDoc, "https://login.microsoftonline.com/" + String(paramTenantValue) + "/oauth2/v2.0/token", payload, capacity);
+// Token endpoint of the configured tenant
+String getTokenUrl() {
+	return "https://login.microsoftonline.com/" + String(paramTenantValue) + "/oauth2/v2.0/token";
+}
 
+// Poll for access token (runs in the network task)
+boolean pollForToken(const char* url, const char* payload) {
+	LOG_DEBUG("pollForToken()");
+
+	// Tokens are written directly into their buffers while the response is read
+	tokenFields[0] = tokenField("access_token", TOKEN_ACCESS);
+	tokenFields[1] = tokenField("refresh_token", TOKEN_REFRESH);
+	tokenFields[2] = tokenField("id_token", TOKEN_ID);
+	tokenFields[3] = { "expires_in", tokenExpiresIn, sizeof(tokenExpiresIn) };
+	tokenFields[4] = { "error", tokenError, sizeof(tokenError) };
+	tokenFields[5] = { "error_description", tokenErrorDescription, sizeof(tokenErrorDescription) };
+	return requestJsonFields(tokenFields, 6, url, payload);
+}
+
+void onPollForToken(boolean res) {
 	if (!res) {
 		state = SMODEDEVICELOGINFAILED;
-	} else if (responseDoc.containsKey("error")) {
-		const char* _error = responseDoc["error"];
-		const char* _error_description = responseDoc["error_description"];
-
-		if (strcmp(_error, "authorization_pending") == 0) {
-			Serial.printf("pollForToken() - Wating for authorization by user: %s\n\n", _error_description);
+	} else if (tokenFields[4].found) {
+		if (strcmp(tokenError, "authorization_pending") == 0) {
+			LOG_INFO("pollForToken() - Wating for authorization by user: %s", tokenErrorDescription);
 		} else {
-			Serial.printf("pollForToken() - Unexpected error: %s, %s\n\n", _error, _error_description);
+			LOG_WARN("pollForToken() - Unexpected error: %s, %s", tokenError, tokenErrorDescription);
 			state = SMODEDEVICELOGINFAILED;
 		}
 	} else {
-		if (responseDoc.containsKey("access_token") && responseDoc.containsKey("refresh_token") && responseDoc.containsKey("id_token")) {
-			// Save tokens and expiration
-			access_token = responseDoc["access_token"].as<String>();
-			refresh_token = responseDoc["refresh_token"].as<String>();
-			id_token = responseDoc["id_token"].as<String>();
-			unsigned int _expires_in = responseDoc["expires_in"].as<unsigned int>();
-			expires = millis() + (_expires_in * 1000); // Calculate timestamp when token expires
+		if (tokenFieldValid(tokenFields[0]) && tokenFieldValid(tokenFields[1]) && tokenFieldValid(tokenFields[2])) {
+			commitTokens(tokenFields);
+
+			// Save expiration
+			unsigned int _expires_in_sec = strtoul(tokenExpiresIn, NULL, 10);
+			setTokenExpiry(tokenSchedule, uptimeMs(), _expires_in_sec); // Calculate timestamp when token expires
 
 			// Set state
 			state = SMODEAUTHREADY;
+		} else if (tokenFields[0].truncated || tokenFields[1].truncated || tokenFields[2].truncated) {
+			LOG_ERROR("pollForToken() - Token exceeds buffer size");
+			state = SMODEDEVICELOGINFAILED;
 		} else {
-			Serial.printf("pollForToken() - Unknown response: %s\n", responseDoc.as<const char*>());
+			LOG_WARN("pollForToken() - Unknown response");
 		}
 	}
 }
 
-// Get presence information
-void pollPresence() {
+// Handle error response of a presence request
+void handlePresenceError(const char* _error_code) {
+	if (strcmp(_error_code, "InvalidAuthenticationToken")) {
+		DBG_PRINTLN(F("pollPresence() - Refresh needed"));
+		tsPolling = uptimeMs();
+		state = SMODEREFRESHTOKEN;
+	} else {
+		LOG_WARN("pollPresence() - Error: %s", _error_code);
+		state = SMODEPRESENCEREQUESTERROR;
+		retries++;
+	}
+}
+
+// Presence response, written by the network task. Large enough for the team presence response.
+const size_t presenceCapacity = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(MAX_USERS) + MAX_USERS * (JSON_OBJECT_SIZE(3) + 120);
+StaticJsonDocument<presenceCapacity> presenceDoc;
+
+// Get presence information of all configured users with a single request
+// See: https://docs.microsoft.com/en-us/graph/api/cloudcommunications-getpresencesbyuserid
+boolean pollTeamPresence(const char* url, const char* payload) {
+	// Only the needed fields are kept, the filter applies to all elements of the array
+	StaticJsonDocument<JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(1)> filter;
+	filter["value"][0]["id"] = true;
+	filter["value"][0]["availability"] = true;
+	filter["value"][0]["activity"] = true;
+	filter["error"]["code"] = true;
+
+	return requestJsonApi(presenceDoc, url, payload, presenceCapacity, "POST", true, &filter);
+}
+
+// Get presence information (runs in the network task)
+boolean pollPresence(const char* url, const char* payload) {
 	// See: https://github.com/microsoftgraph/microsoft-graph-docs/blob/ananya/api-reference/beta/resources/presence.md
-	const size_t capacity = JSON_OBJECT_SIZE(4) + 500;
-	DynamicJsonDocument responseDoc(capacity);
-	boolean res = requestJsonApi(responseDoc, "https://graph.microsoft.com/v1.0/me/presence", "", capacity, "GET", true);
+	// Only the needed fields are kept, everything else is skipped while parsing the response stream
+	StaticJsonDocument<JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(1)> filter;
+	filter["availability"] = true;
+	filter["activity"] = true;
+	filter["error"]["code"] = true;
 
+	return requestJsonApi(presenceDoc, url, payload, presenceCapacity, "GET", true, &filter);
+}
+
+// Show the presence response and schedule the next poll
+void onPollPresence(boolean res) {
+	boolean success = false;
 	if (!res) {
+		recordPollFailure(httpsLastCode);
 		state = SMODEPRESENCEREQUESTERROR;
 		retries++;
-	} else if (responseDoc.containsKey("error")) {
-		const char* _error_code = responseDoc["error"]["code"];
-		if (strcmp(_error_code, "InvalidAuthenticationToken")) {
-			DBG_PRINTLN(F("pollPresence() - Refresh needed"));
-			tsPolling = millis();
-			state = SMODEREFRESHTOKEN;
-		} else {
-			Serial.printf("pollPresence() - Error: %s\n", _error_code);
-			state = SMODEPRESENCEREQUESTERROR;
-			retries++;
+	} else if (presenceDoc.containsKey("error")) {
+		recordPollFailure(httpsLastCode);
+		strlcpy(presenceErrorCode, presenceDoc["error"]["code"] | "", PRESENCE_LEN);
+		handlePresenceError(presenceErrorCode);
+	} else if (presenceDoc.containsKey("value")) {
+		// Team presence
+		for (JsonObject presence : presenceDoc["value"].as<JsonArray>()) {
+			int8_t user = getUserIndex(presence["id"] | "");
+			if (user < 0) {
+				continue;
+			}
+			strlcpy(userAvailability[user], presence["availability"] | "", PRESENCE_LEN);
+			strlcpy(userActivity[user], presence["activity"] | "", PRESENCE_LEN);
+			LOG_INFO("--> User %d: %s, %s", user, userAvailability[user], userActivity[user]);
+			updatePresence(user, userActivity[user]);
+
+			// The first user is reported like the own presence
+			if (user == 0) {
+				strlcpy(availability, userAvailability[user], PRESENCE_LEN);
+				strlcpy(activity, userActivity[user], PRESENCE_LEN);
+			}
 		}
+		retries = 0;
+		success = true;
 	} else {
 		// Store presence info
-		availability = responseDoc["availability"].as<String>();
-		activity = responseDoc["activity"].as<String>();
+		strlcpy(availability, presenceDoc["availability"] | "", PRESENCE_LEN);
+		strlcpy(activity, presenceDoc["activity"] | "", PRESENCE_LEN);
 		retries = 0;
+		success = true;
 
-		setPresenceAnimation();
+		updatePresence(0, activity);
 	}
+
+	setStatusAnimation();
+	if (success) {
+		tsPolling = uptimeMs() + (nextPollInterval(pollScheduler, presenceChanged, isEverybodyOffline(), getCurrentHour()) * 1000UL);
+		presenceChanged = false;
+	} else if (state == SMODEPRESENCEREQUESTERROR) {
+		// Retry after the base interval, never after the backoff of the adaptive interval
+		tsPolling = uptimeMs() + (pollScheduler.baseInterval * 1000UL);
+	}
+	LOG_INFO("--> Availability: %s, Activity: %s", availability, activity);
 }
 
-// Refresh the access token
-boolean refreshToken() {
-	boolean success = false;
+// Refresh the access token (runs in the network task)
+boolean refreshToken(const char* url, const char* payload) {
 	// See: https://docs.microsoft.com/de-de/azure/active-directory/develop/v1-protocols-oauth-code#refreshing-the-access-tokens
-	String payload = "client_id=" + String(paramClientIdValue) + "&grant_type=refresh_token&refresh_token=" + refresh_token;
 	DBG_PRINTLN(F("refreshToken()"));
 
-	const size_t capacity = JSON_OBJECT_SIZE(7) + 10000;
-	DynamicJsonDocument responseDoc(capacity);
-	boolean res = requestJsonApi(responseDoc, "https://login.microsoftonline.com/" + String(paramTenantValue) + "/oauth2/v2.0/token", payload, capacity);
+	// Tokens are written directly into their buffers while the response is read
+	tokenFields[0] = tokenField("access_token", TOKEN_ACCESS);
+	tokenFields[1] = tokenField("refresh_token", TOKEN_REFRESH);
+	tokenFields[2] = tokenField("id_token", TOKEN_ID);
+	tokenFields[3] = { "expires_in", tokenExpiresIn, sizeof(tokenExpiresIn) };
+	return requestJsonFields(tokenFields, 4, url, payload);
+}
 
-	// Replace tokens and expiration
-	if (res && responseDoc.containsKey("access_token") && responseDoc.containsKey("refresh_token")) {
-		if (!responseDoc["access_token"].isNull()) {
-			access_token = responseDoc["access_token"].as<String>();
-			success = true;
-		}
-		if (!responseDoc["refresh_token"].isNull()) {
-			refresh_token = responseDoc["refresh_token"].as<String>();
-			success = true;
-		}
-		if (!responseDoc["id_token"].isNull()) {
-			id_token = responseDoc["id_token"].as<String>();
-		}
-		if (!responseDoc["expires_in"].isNull()) {
-			int _expires_in = responseDoc["expires_in"].as<unsigned int>();
-			expires = millis() + (_expires_in * 1000); // Calculate timestamp when token expires
+// Handle the refresh response, used for the refresh in SMODEREFRESHTOKEN and in the background
+void onRefreshToken(boolean res) {
+	// Check new tokens and expiration, the current tokens are only replaced by complete ones
+	if (res && tokenFieldValid(tokenFields[0]) && tokenFieldValid(tokenFields[1]) && !tokenFields[2].truncated) {
+		commitTokens(tokenFields);
+		if (tokenFields[3].found) {
+			unsigned int _expires_in_sec = strtoul(tokenExpiresIn, NULL, 10);
+			setTokenExpiry(tokenSchedule, uptimeMs(), _expires_in_sec); // Calculate timestamp when token expires
 		}
 
 		DBG_PRINTLN(F("refreshToken() - Success"));
-		state = SMODEPOLLPRESENCE;
+		metricsAdd(metricTokenRefreshes);
+		if (state == SMODEREFRESHTOKEN) {
+			state = SMODEPOLLPRESENCE;
+		}
+		saveContext();
 	} else {
 		DBG_PRINTLN(F("refreshToken() - Error:"));
+		metricsAdd(metricTokenRefreshFailures);
 		// Set retry after timeout
-		tsPolling = millis() + (DEFAULT_ERROR_RETRY_INTERVAL * 1000);
+		if (state == SMODEREFRESHTOKEN) {
+			tsPolling = uptimeMs() + (DEFAULT_ERROR_RETRY_INTERVAL * 1000);
+		} else {
+			delayTokenRefresh(tokenSchedule, uptimeMs(), DEFAULT_ERROR_RETRY_INTERVAL);
+		}
 	}
-	return success;
+}
+
+// Start the jobs above, URL and payload are built here from the current settings and tokens.
+// They are called on every loop() while due, so nothing is built while another job is in flight.
+boolean startPollForToken() {
+	if (networkBusy) {
+		return false;
+	}
+	return startNetworkJob(pollForToken, onPollForToken, getTokenUrl(), "client_id=" + String(paramClientIdValue) + "&grant_type=urn:ietf:params:oauth:grant-type:device_code&device_code=" + device_code);
+}
+
+boolean startPollPresence() {
+	if (networkBusy) {
+		return false;
+	}
+	if (numberUsers > 0) {
+		return startNetworkJob(pollTeamPresence, onPollPresence, "https://" GRAPH_API_HOST "/v1.0/communications/getPresencesByUserId", teamPresencePayload);
+	}
+	return startNetworkJob(pollPresence, onPollPresence, "https://" GRAPH_API_HOST "/v1.0/me/presence");
+}
+
+boolean startRefreshToken() {
+	if (networkBusy) {
+		return false;
+	}
+	return startNetworkJob(refreshToken, onRefreshToken, getTokenUrl(), "client_id=" + String(paramClientIdValue) + "&grant_type=refresh_token&refresh_token=" + String(refresh_token));
 }
 
 // Implementation of a statemachine to handle the different application states
@@ -469,6 +1082,7 @@ void statemachine() {
 	{
 		setAnimation(0, FX_MODE_THEATER_CHASE, GREEN);
 		startMDNS();
+		configTzTime(paramTimezoneValue, NTP_SERVER);
 		loadContext();
 		// WiFi client
 		DBG_PRINTLN(F("Wifi connected, waiting for requests ..."));
@@ -479,9 +1093,8 @@ void statemachine() {
 		if (laststate != SMODEDEVICELOGINSTARTED) {
 			setAnimation(0, FX_MODE_THEATER_CHASE, PURPLE);
 		}
-		if (millis() >= tsPolling) {
-			pollForToken();
-			tsPolling = millis() + (interval * 1000);
+		if (uptimeMs() >= tsPolling && startPollForToken()) {
+			tsPolling = uptimeMs() + (interval * 1000);
 		}
 	}
 
@@ -495,20 +1108,23 @@ void statemachine() {
 	if (state == SMODEAUTHREADY) {
 		saveContext();
 		state = SMODEPOLLPRESENCE;
-		tsPolling = millis();
+		tsPolling = uptimeMs();
 	}
 
 	// Statemachine: Poll for presence information, even if there was a error before (handled below)
 	if (state == SMODEPOLLPRESENCE) {
-		if (millis() >= tsPolling) {
-			DBG_PRINTLN(F("Polling presence info ..."));
-			pollPresence();
-			tsPolling = millis() + (atoi(paramPollIntervalValue) * 1000);
-			Serial.printf("--> Availability: %s, Activity: %s\n\n", availability.c_str(), activity.c_str());
+		if (uptimeMs() >= tsPolling && startPollPresence()) {
+			LOG_DEBUG("Polling presence info ...");
 		}
 
-		if (getTokenLifetime() < TOKEN_REFRESH_TIMEOUT) {
-			Serial.printf("Token needs refresh, valid for %d s.\n", getTokenLifetime());
+		// Refresh the token in the background while polling continues with the current one
+		if (isBackgroundRefreshDue(tokenSchedule, uptimeMs()) && startRefreshToken()) {
+			LOG_INFO("Token refresh in background, valid for %d s.", getTokenLifetime());
+		}
+
+		// State changes only while no request is in flight
+		if (!networkBusy && isTokenRefreshRequired(tokenSchedule, uptimeMs())) {
+			LOG_INFO("Token needs refresh, valid for %d s.", getTokenLifetime());
 			state = SMODEREFRESHTOKEN;
 		}
 	}
@@ -518,11 +1134,8 @@ void statemachine() {
 		if (laststate != SMODEREFRESHTOKEN) {
 			setAnimation(0, FX_MODE_THEATER_CHASE, RED);
 		}
-		if (millis() >= tsPolling) {
-			boolean success = refreshToken();
-			if (success) {
-				saveContext();
-			}
+		if (uptimeMs() >= tsPolling) {
+			startRefreshToken();
 		}
 	}
 
@@ -532,7 +1145,7 @@ void statemachine() {
 			retries = 0;
 		}
 		
-		Serial.printf("Polling presence failed, retry #%d.\n", retries);
+		LOG_WARN("Polling presence failed, retry #%d.", retries);
 		if (retries >= 5) {
 			// Try token refresh
 			state = SMODEREFRESHTOKEN;
@@ -544,6 +1157,7 @@ void statemachine() {
 	// Update laststate
 	if (laststate != state) {
 		laststate = state;
+		setStatusAnimation();
 		DBG_PRINTLN(F("======================================================================"));
 	}
 }
@@ -552,19 +1166,112 @@ void statemachine() {
 /**
  * Multicore
  */
+// All segments show a static color, nothing changes until the next setAnimation()
+boolean isStaticFrame() {
+	for (uint8_t i = 0; i < ws2812fx.getNumSegments(); i++) {
+		if (ws2812fx.getMode(i) != FX_MODE_STATIC) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void customShow(void) {
+	sendFrame(ws2812fx, false);
+}
+
+// Frame period in ticks, never shorter than the time the longest part of the strip needs on the wire
+TickType_t getLedFrameBudget() {
+	uint8_t channels = max(tx_num_channels, (uint8_t)1);
+	uint32_t ledsPerChannel = (numberLeds + channels - 1) / channels;
+	uint32_t wireTime = ledsPerChannel * LED_WIRE_TIME_PER_LED + LED_WIRE_TIME_RESET;
+	uint32_t budget = max((uint32_t)(1000 / LED_FPS), (wireTime + 999) / 1000);
+	ledFrameBudget = budget;
+	return max(pdMS_TO_TICKS(budget), (TickType_t)1);
+}
+
 void neopixelTask(void * parameter) {
+	TickType_t lastWake = xTaskGetTickCount();
+	TickType_t budget = getLedFrameBudget();
+	unsigned long tsLastFrame = micros() - budget * portTICK_PERIOD_MS * 1000;
 	for (;;) {
+		// Deviation of the last period from the budget
+		unsigned long tsFrame = micros();
+		uint32_t period = tsFrame - tsLastFrame;
+		uint32_t budgetTime = budget * portTICK_PERIOD_MS * 1000;
+		uint32_t jitter = period > budgetTime ? period - budgetTime : budgetTime - period;
+		recordHistogram(metricLedJitter, jitter);
+		ledJitterMax = max(ledJitterMax, jitter);
+		tsLastFrame = tsFrame;
+		ledFrames++;
+		budget = getLedFrameBudget();
+
+		uint32_t frames = framesSent + framesSkipped;
+		unsigned long tsService = micros();
 		ws2812fx.service();
-		vTaskDelay(10);
+		if (framesSent + framesSkipped != frames) {
+			recordHistogram(metricLedRender, micros() - tsService - ledTransmitTime);
+		} else if (colorNeedsRefresh() || transitionActive()) {
+			// next dithering or crossfade step, or new colour tables for an unchanged frame
+			sendFrame(ws2812fx, true);
+		}
+		if (isStaticFrame() && !colorNeedsRefresh() && !transitionActive()) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			// Start a new cadence
+			lastWake = xTaskGetTickCount();
+			tsLastFrame = micros() - budget * portTICK_PERIOD_MS * 1000;
+			continue;
+		}
+		TickType_t elapsed = xTaskGetTickCount() - lastWake;
+		if (elapsed > budget) {
+			// Overrun: drop the missed frames instead of catching up with a burst. A frame that
+			// took exactly its budget is on time, every started budget after it is a dropped slot.
+			ledOverruns++;
+			ledFramesDropped += (elapsed - 1) / budget;
+			lastWake = xTaskGetTickCount();
+		}
+		vTaskDelayUntil(&lastWake, budget);
 	}
 }
 
-void customShow(void) {
-	uint8_t *pixels = ws2812fx.getPixels();
-	// numBytes is one more then the size of the ws2812fx's *pixels array.
-	// the extra byte is used by the driver to insert the LED reset pulse at the end.
-	uint16_t numBytes = ws2812fx.getNumBytes() + 1;
-	rmt_write_sample(RMT_CHANNEL_0, pixels, numBytes, false); // channel 0
+// Tick hooks, sample which task each core was running when the tick interrupt came in
+void IRAM_ATTR countTick(BaseType_t cpu) {
+	totalTicks[cpu]++;
+	if (xTaskGetCurrentTaskHandleForCPU(cpu) == xTaskGetIdleTaskHandleForCPU(cpu)) {
+		idleTicks[cpu]++;
+	}
+}
+
+void IRAM_ATTR tickHookCore0() {
+	countTick(0);
+}
+
+void IRAM_ATTR tickHookCore1() {
+	countTick(1);
+}
+
+// Idle time per core from the ticks sampled during the last second
+void updateIdleStats() {
+	unsigned long elapsed = millis() - tsIdleStats;
+	if (elapsed >= 1000) {
+		for (uint8_t i = 0; i < portNUM_PROCESSORS; i++) {
+			// Counters are only written by the tick interrupt, differences survive their wrap
+			uint32_t idle = idleTicks[i] - idleTicksLast[i];
+			uint32_t total = totalTicks[i] - totalTicksLast[i];
+			idleTicksLast[i] += idle;
+			totalTicksLast[i] += total;
+			idlePercent[i] = total > 0 ? min(idle * 100 / total, (uint32_t)100) : 0;
+		}
+		ledFps = (ledFrames - ledFramesLast) * 1000 / elapsed;
+		ledFramesLast = ledFrames;
+		uint32_t stackFree = TaskNeopixel != NULL ? uxTaskGetStackHighWaterMark(TaskNeopixel) : 0;
+		if (stackFree < LED_TASK_STACK_LOW && stackFree != ledStackFree) {
+			LOG_WARN("LED task stack low, %u bytes left", stackFree);
+		}
+		ledStackFree = stackFree;
+		tsIdleStats = millis();
+		updateHeapMetrics();
+	}
 }
 
 
@@ -574,6 +1281,7 @@ void customShow(void) {
 void setup()
 {
 	Serial.begin(115200);
+	initLogger();
 	DBG_PRINTLN();
 	DBG_PRINTLN(F("setup() Starting up..."));
 	// Serial.setDebugOutput(true);
@@ -581,9 +1289,19 @@ void setup()
 		DBG_PRINTLN(F("WARNING: Checking of HTTPS certificates disabled."));
 	#endif
 
+	// Token storage, nothing works without it
+	if (!initTokenArena()) {
+		while(1) {
+			delay(1000);
+		}
+	}
+
 	// WS2812FX
 	ws2812fx.init();
-	rmt_tx_int(RMT_CHANNEL_0, ws2812fx.getPin());
+	// keep full resolution in the pixel buffer, brightness is applied by the colour pipeline
+	ws2812fx.setBrightness(255);
+	uint8_t channels = rmt_tx_init_pins(RMT_PINS, ws2812fx.getPin());
+	Serial.printf("setup: %d RMT channel(s)\n", channels);
 	ws2812fx.start();
 	setAnimation(0, FX_MODE_STATIC, WHITE);
 
@@ -596,7 +1314,14 @@ void setup()
 	iotWebConf.addParameter(&paramClientId);
 	iotWebConf.addParameter(&paramTenant);
 	iotWebConf.addParameter(&paramPollInterval);
+	iotWebConf.addParameter(&paramPollIntervalMax);
+	iotWebConf.addParameter(&paramWorkingHours);
+	iotWebConf.addParameter(&paramTimezone);
 	iotWebConf.addParameter(&paramNumLeds);
+	iotWebConf.addParameter(&paramSegments);
+	iotWebConf.addParameter(&paramBrightness);
+	iotWebConf.addParameter(&paramColorTemperature);
+	iotWebConf.addParameter(&paramUsers);
 	// iotWebConf.setFormValidator(&formValidator);
 	// iotWebConf.getApTimeoutParameter()->visible = true;
 	// iotWebConf.getApTimeoutParameter()->defaultValue = "10";
@@ -614,6 +1339,15 @@ void setup()
 	}
 	ws2812fx.setLength(numberLeds);
 	ws2812fx.setCustomShow(customShow);
+	initFrameCapture(ws2812fx);
+	initColorPipeline();
+	initSegments();
+	initUsers();
+	initPolling();
+
+	// HTTPS connection pool
+	initApiConnections();
+	initNetworkTask();
 
 	// HTTP server - Set up required URL handlers on the web server.
 	server.on("/", HTTP_GET, handleRoot);
@@ -623,12 +1357,18 @@ void setup()
 	server.on("/api/startDevicelogin", HTTP_GET, [] { handleStartDevicelogin(); });
 	server.on("/api/settings", HTTP_GET, [] { handleGetSettings(); });
 	server.on("/api/clearSettings", HTTP_GET, [] { handleClearSettings(); });
+	server.on("/metrics", HTTP_GET, handleMetrics);
+	server.on("/api/log", HTTP_GET, handleGetLog);
+#if LED_CAPTURE_BYTES > 0
+	server.on("/api/frames", HTTP_GET, handleGetFrames);
+#endif
 	server.on("/fs/delete", HTTP_DELETE, handleFileDelete);
 	server.on("/fs/list", HTTP_GET, handleFileList);
-	server.on("/fs/upload", HTTP_POST, []() {
-		server.send(200, "text/plain", "");
-	}, handleFileUpload);
+	server.on("/fs/upload", HTTP_POST, handleFileUploadDone, handleFileUpload);
 
+	// Request headers needed to revalidate SPIFFS files by their ETag
+	const char* fileHeaderKeys[] = {"If-None-Match"};
+	server.collectHeaders(fileHeaderKeys, 1);
 	// server.onNotFound([](){ iotWebConf.handleNotFound(); });
 	server.onNotFound([]() {
 		iotWebConf.handleNotFound();
@@ -645,22 +1385,37 @@ void setup()
 		DBG_PRINTLN("SPIFFS Mount Failed");
         return;
     }
+	loadPresenceAnimations();
+	buildFileIndex();
 
 	// Pin neopixel logic to core 0
 	xTaskCreatePinnedToCore(
 		neopixelTask,
 		"Neopixels",
-		1000,
+		LED_TASK_STACK,
 		NULL,
 		1,
 		&TaskNeopixel,
 		0);
+
+	// Idle time statistics
+	esp_register_freertos_tick_hook_for_cpu(tickHookCore0, 0);
+	esp_register_freertos_tick_hook_for_cpu(tickHookCore1, 1);
 }
 
 void loop()
 {
+	unsigned long tsLoop = millis();
+
 	// iotWebConf - doLoop should be called as frequently as possible.
 	iotWebConf.doLoop();
 
+	handleNetworkResults();
 	statemachine();
+
+	updateIdleStats();
+
+	if (millis() - tsLoop > loopMaxTime) {
+		loopMaxTime = millis() - tsLoop;
+	}
 }
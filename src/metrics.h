@@ -0,0 +1,121 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Metrics
+ *
+ * Counters and fixed bucket histograms, rendered in the Prometheus text format. Samples are
+ * recorded with relaxed atomic adds only, so any task can record without taking a lock.
+ */
+#define METRICS_PREFIX "espteams_"
+#define HISTOGRAM_MAX_BUCKETS 12
+#define POLL_FAILURE_CODES 8					// Number of different HTTP codes counted for failed polls
+
+struct Histogram {
+	const char* name;
+	const char* help;
+	const uint32_t* bounds;							// Upper bounds of the buckets in microseconds
+	uint8_t numBounds;
+	uint32_t counts[HISTOGRAM_MAX_BUCKETS + 1];		// Per bucket, the last one is +Inf
+	uint32_t sumLow;								// Sum of all samples in microseconds
+	uint32_t sumHigh;
+};
+#define HISTOGRAM_BOUNDS(bounds) bounds, sizeof(bounds) / sizeof(bounds[0])
+
+inline void metricsAdd(uint32_t& counter, uint32_t value = 1) {
+	__atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+}
+
+// Record a sample (microseconds)
+void recordHistogram(Histogram& h, uint32_t value) {
+	uint8_t i = 0;
+	while (i < h.numBounds && value > h.bounds[i]) {
+		i++;
+	}
+	metricsAdd(h.counts[i]);
+	if (__atomic_add_fetch(&h.sumLow, value, __ATOMIC_RELAXED) < value) {
+		metricsAdd(h.sumHigh);
+	}
+}
+
+// Bucket bounds (microseconds)
+const uint32_t networkBounds[] = { 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+const uint32_t ledBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000 };
+
+Histogram metricConnect = { "api_connect_seconds", "DNS lookup, TCP connect and TLS handshake time of new API connections", HISTOGRAM_BOUNDS(networkBounds) };
+Histogram metricTtfb = { "api_ttfb_seconds", "Time until the response header of an API request was received", HISTOGRAM_BOUNDS(networkBounds) };
+Histogram metricTotal = { "api_request_seconds", "Total time of an API request", HISTOGRAM_BOUNDS(networkBounds) };
+Histogram metricParse = { "api_parse_seconds", "Time to read and parse an API response body", HISTOGRAM_BOUNDS(networkBounds) };
+Histogram metricLedRender = { "led_render_seconds", "Time to render an LED frame, including the tick WS2812FX yields before showing it", HISTOGRAM_BOUNDS(ledBounds) };
+Histogram metricLedJitter = { "led_frame_jitter_seconds", "Deviation of the LED frame period from its budget", HISTOGRAM_BOUNDS(ledBounds) };
+Histogram metricLedTransition = { "led_transition_seconds", "Time to crossfade an LED frame during a transition", HISTOGRAM_BOUNDS(ledBounds) };
+Histogram metricLedColor = { "led_color_seconds", "Time to apply gamma, brightness and dithering to an LED frame", HISTOGRAM_BOUNDS(ledBounds) };
+Histogram metricLedTransmit = { "led_transmit_seconds", "Time to process an LED frame and hand it to the RMT driver", HISTOGRAM_BOUNDS(ledBounds) };
+Histogram* const histograms[] = { &metricConnect, &metricTtfb, &metricTotal, &metricParse, &metricLedRender, &metricLedJitter, &metricLedTransition, &metricLedColor, &metricLedTransmit };
+
+// Counters
+uint32_t metricTokenRefreshes = 0;
+uint32_t metricTokenRefreshFailures = 0;
+
+// Failed presence polls per HTTP code (negative codes are connection errors)
+struct CodeCounter {
+	int32_t code;		// 0 if unused
+	uint32_t count;
+};
+CodeCounter metricPollFailures[POLL_FAILURE_CODES];
+
+void recordPollFailure(int32_t code) {
+	for (uint8_t i = 0; i < POLL_FAILURE_CODES; i++) {
+		int32_t unused = 0;
+		if (metricPollFailures[i].code == code || __atomic_compare_exchange_n(&metricPollFailures[i].code, &unused, code, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			metricsAdd(metricPollFailures[i].count);
+			return;
+		}
+	}
+}
+
+// Largest free heap block low-water mark, sampled once per second. The free heap low-water mark is kept by the SDK.
+uint32_t metricLargestBlockLowWater = UINT32_MAX;
+
+void updateHeapMetrics() {
+	uint32_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+	if (largestBlock < metricLargestBlockLowWater) {
+		metricLargestBlockLowWater = largestBlock;
+	}
+}
+
+void writeMetricHeader(PageWriter& out, const char* name, const char* help, const char* type) {
+	out.printf("# HELP " METRICS_PREFIX "%s ", name);
+	out.print(help);
+	out.printf("\n# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+void writeMetric(PageWriter& out, const char* name, const char* help, const char* type, uint32_t value) {
+	writeMetricHeader(out, name, help, type);
+	out.printf(METRICS_PREFIX "%s %u\n", name, value);
+}
+
+void writeHistogram(PageWriter& out, const Histogram& h) {
+	writeMetricHeader(out, h.name, h.help, "histogram");
+	uint32_t count = 0;
+	for (uint8_t i = 0; i <= h.numBounds; i++) {
+		count += h.counts[i];
+		if (i < h.numBounds) {
+			out.printf(METRICS_PREFIX "%s_bucket{le=\"%u.%06u\"} %u\n", h.name, h.bounds[i] / 1000000, h.bounds[i] % 1000000, count);
+		} else {
+			out.printf(METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %u\n", h.name, count);
+		}
+	}
+	uint64_t sum = ((uint64_t)h.sumHigh << 32) | h.sumLow;
+	out.printf(METRICS_PREFIX "%s_sum %llu.%06u\n", h.name, (unsigned long long)(sum / 1000000), (uint32_t)(sum % 1000000));
+	out.printf(METRICS_PREFIX "%s_count %u\n", h.name, count);
+}
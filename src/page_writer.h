@@ -0,0 +1,132 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Chunked page writer
+ *
+ * Renders a template held in flash into a fixed size buffer and hands every full
+ * buffer to a sink (e.g. a chunked HTTP response). Placeholders are written as
+ * %NAME% and filled in by a callback, so a page never needs more memory than the
+ * chunk buffer.
+ */
+#ifndef PAGE_CHUNK_SIZE
+#define PAGE_CHUNK_SIZE 512						// Size of the page chunk buffer (if not set via build flags)
+#endif
+
+#define PAGE_PLACEHOLDER_LEN 24					// Max. length of a placeholder name
+#define PAGE_PLACEHOLDER_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_"
+
+class PageWriter;
+
+typedef void (*PageSink)(const char* data, size_t length);
+typedef bool (*PagePlaceholder)(PageWriter& writer, const char* name);	// Returns false for unknown names
+
+class PageWriter {
+public:
+	PageWriter(PageSink sink) : _sink(sink) {}
+
+	// Number of bytes handed to the sink so far
+	size_t bytesWritten() const { return _written; }
+
+	void write(const char* data, size_t length) {
+		if (_length + length > sizeof(_buffer)) {
+			flush();
+		}
+		if (length >= sizeof(_buffer)) {
+			// Large blocks go to the sink directly
+			send(data, length);
+			return;
+		}
+		memcpy(_buffer + _length, data, length);
+		_length += length;
+	}
+
+	void print(const char* s) {
+		write(s, strlen(s));
+	}
+
+	void print(uint32_t value) {
+		char number[11];
+		int length = snprintf(number, sizeof(number), "%u", value);
+		write(number, length);
+	}
+
+	void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char line[128];
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		if (length > 0) {
+			write(line, min((size_t)length, sizeof(line) - 1));
+		}
+	}
+
+	// Print text to be used inside an HTML attribute or element
+	void printEscaped(const char* s) {
+		for (; *s; s++) {
+			switch (*s) {
+				case '"': print("&quot;"); break;
+				case '&': print("&amp;"); break;
+				case '<': print("&lt;"); break;
+				case '>': print("&gt;"); break;
+				default: write(s, 1);
+			}
+		}
+	}
+
+	// Render the template, unknown or malformed placeholders are written unchanged
+	void render(const char* tpl, PagePlaceholder placeholder) {
+		const char* text = tpl;
+		for (const char* p = tpl; *p; p++) {
+			if (*p != '%') {
+				continue;
+			}
+			const char* end = strchr(p + 1, '%');
+			if (end == NULL) {
+				break;
+			}
+			size_t nameLength = end - p - 1;
+			if (nameLength == 0 || nameLength >= PAGE_PLACEHOLDER_LEN || strspn(p + 1, PAGE_PLACEHOLDER_CHARS) != nameLength) {
+				continue;
+			}
+			char name[PAGE_PLACEHOLDER_LEN];
+			memcpy(name, p + 1, nameLength);
+			name[nameLength] = 0;
+			write(text, p - text);
+			text = p;
+			if (placeholder(*this, name)) {
+				p = end;
+				text = end + 1;
+			}
+		}
+		print(text);
+	}
+
+	void flush() {
+		if (_length > 0) {
+			send(_buffer, _length);
+			_length = 0;
+		}
+	}
+
+private:
+	PageSink _sink;
+	char _buffer[PAGE_CHUNK_SIZE];
+	size_t _length = 0;
+	size_t _written = 0;
+
+	void send(const char* data, size_t length) {
+		_sink(data, length);
+		_written += length;
+	}
+};
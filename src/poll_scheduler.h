@@ -0,0 +1,100 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Adaptive presence polling scheduler
+ *
+ * Polls fast right after a presence change, uses the base interval during working hours
+ * and backs off exponentially up to the max interval while presence is stable outside of
+ * working hours or everybody is offline. Time is passed in by the caller, so the
+ * scheduler does not depend on the system clock.
+ */
+#ifndef POLL_FAST_COUNT
+#define POLL_FAST_COUNT 3						// Number of fast polls after a presence change (if not set via build flags)
+#endif
+
+struct PollScheduler {
+	// Bounds (seconds)
+	uint16_t fastInterval;
+	uint16_t baseInterval;
+	uint16_t maxInterval;
+
+	// Working hours, [start, end) in local hours, start == end means always
+	uint8_t workStart;
+	uint8_t workEnd;
+
+	// State
+	uint16_t interval;
+	uint8_t fastPollsLeft;
+
+	// Statistics
+	uint32_t polls;
+	uint32_t changes;
+	uint64_t latencySum;	// Sum of the expected detection latency (half the interval) of all changes
+	uint64_t intervalSum;	// Sum of all intervals
+};
+
+void initPollScheduler(PollScheduler& s, uint16_t fastInterval, uint16_t baseInterval, uint16_t maxInterval, uint8_t workStart, uint8_t workEnd) {
+	s.baseInterval = baseInterval;
+	s.fastInterval = fastInterval < baseInterval ? fastInterval : baseInterval;
+	s.maxInterval = maxInterval > baseInterval ? maxInterval : baseInterval;
+	s.workStart = workStart;
+	s.workEnd = workEnd;
+	s.interval = s.baseInterval;
+	s.fastPollsLeft = 0;
+}
+
+// Check if hour (0..23, or -1 if unknown) is within working hours. Unknown time counts as working hours.
+bool isWorkingHour(const PollScheduler& s, int8_t hour) {
+	if (hour < 0 || s.workStart == s.workEnd) {
+		return true;
+	}
+	if (s.workStart < s.workEnd) {
+		return hour >= s.workStart && hour < s.workEnd;
+	}
+	return hour >= s.workStart || hour < s.workEnd;	// Working hours span midnight
+}
+
+// Calculate the interval until the next poll, after a poll with the given outcome
+uint16_t nextPollInterval(PollScheduler& s, bool changed, bool offline, int8_t hour) {
+	s.polls++;
+	if (changed) {
+		// The change happened somewhere within the last interval
+		s.changes++;
+		s.latencySum += s.interval / 2;
+		s.fastPollsLeft = POLL_FAST_COUNT;
+	}
+
+	if (s.fastPollsLeft > 0) {
+		s.fastPollsLeft--;
+		s.interval = s.fastInterval;
+	} else if (offline || !isWorkingHour(s, hour)) {
+		// Exponential backoff while nothing happens
+		uint32_t backoff = s.interval < s.baseInterval ? s.baseInterval : (uint32_t)s.interval * 2;
+		s.interval = backoff > s.maxInterval ? s.maxInterval : backoff;
+	} else {
+		s.interval = s.baseInterval;
+	}
+
+	s.intervalSum += s.interval;
+	return s.interval;
+}
+
+// Average expected time (seconds) between a presence change and its detection
+uint32_t getAverageDetectionLatency(const PollScheduler& s) {
+	return s.changes > 0 ? s.latencySum / s.changes : 0;
+}
+
+// Average number of requests per hour
+uint32_t getRequestsPerHour(const PollScheduler& s) {
+	return s.intervalSum > 0 ? (uint64_t)s.polls * 3600 / s.intervalSum : 0;
+}
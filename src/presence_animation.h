@@ -0,0 +1,67 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Presence animations
+ */
+#define ANIMATIONS_FILE "/animations.json"		// Filename of the optional animation overrides
+
+// Parse color given as number or as "#RRGGBB" string
+uint32_t parseAnimationColor(JsonVariant value, uint32_t defaultColor) {
+	if (value.is<const char*>()) {
+		const char* color = value.as<const char*>();
+		if (color[0] == '#') {
+			return strtoul(color + 1, NULL, 16);
+		}
+		return defaultColor;
+	}
+	return value | defaultColor;
+}
+
+// Load animation overrides from SPIFFS, e.g. {"Busy": {"mode": 3, "color": "#FF0000", "speed": 1000}}
+void loadPresenceAnimations() {
+	File file = SPIFFS.open(ANIMATIONS_FILE);
+	if (!file || file.isDirectory()) {
+		DBG_PRINTLN(F("loadPresenceAnimations() - No file found, using defaults"));
+		return;
+	}
+
+	const size_t capacity = JSON_OBJECT_SIZE(ACTIVITY_COUNT) + ACTIVITY_COUNT * JSON_OBJECT_SIZE(3) + 1024;
+	DynamicJsonDocument doc(capacity);
+	DeserializationError err = deserializeJson(doc, file);
+	file.close();
+
+	if (err) {
+		DBG_PRINT(F("loadPresenceAnimations() - deserializeJson() failed with code: "));
+		DBG_PRINTLN(err.c_str());
+		return;
+	}
+
+	int numOverrides = 0;
+	for (JsonPair entry : doc.as<JsonObject>()) {
+		Activity id = getActivity(entry.key().c_str());
+		if (id == ACTIVITY_UNKNOWN) {
+			Serial.printf("loadPresenceAnimations() - Unknown activity: %s\n", entry.key().c_str());
+			continue;
+		}
+		JsonObject animation = entry.value().as<JsonObject>();
+		PresenceAnimation& a = presenceAnimations[id];
+		a.mode = animation["mode"] | a.mode;
+		a.color = parseAnimationColor(animation["color"], a.color);
+		a.speed = animation["speed"] | a.speed;
+		if (a.mode >= ws2812fx.getModeCount()) {
+			a.mode = FX_MODE_STATIC;
+		}
+		numOverrides++;
+	}
+	Serial.printf("loadPresenceAnimations() - %d overrides loaded\n", numOverrides);
+}
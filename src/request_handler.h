@@ -11,90 +11,310 @@
  */
 
 /**
- * API request handler
+ * HTTPS connection pool
  */
-boolean requestJsonApi(JsonDocument& doc, String url, String payload = "", size_t capacity = 0, String type = "POST", boolean sendAuth = false) {
-	// WiFiClient
-	WiFiClientSecure *client = new WiFiClientSecure;
+// One persistent connection per API host, kept open between requests (HTTP/1.1 keep-alive)
+struct ApiConnection {
+	const char* host;
+	WiFiClientSecure client;
+	HTTPClient https;
+};
+ApiConnection apiConnections[] = {
+	{ GRAPH_API_HOST },
+	{ "login.microsoftonline.com" }
+};
+#define NUM_API_CONNECTIONS (sizeof(apiConnections) / sizeof(apiConnections[0]))
+
+// Connection statistics
+uint32_t httpsRequests = 0;
+uint32_t httpsHandshakes = 0;
+uint32_t httpsLastLatency = 0;
+uint32_t httpsTotalLatency = 0;
+int httpsLastCode = 0;
+
+const char* headerKeys[] = { "Transfer-Encoding" };
+
+#ifndef HTTPS_DRAIN_LIMIT
+#define HTTPS_DRAIN_LIMIT 2048					// Max. unread response bytes skipped to keep a connection open (if not set via build flags)
+#endif
+#define HTTPS_CONNECT_TIMEOUT 10000				// Connect timeout of API connections (ms)
+#define HTTPS_TIMEOUT 10000						// Read timeout of API responses (ms)
+#define HTTPS_ERROR_BODY_LEN 128				// Start of an unexpected response that is logged
+
+char httpsErrorBody[HTTPS_ERROR_BODY_LEN];		// Written by the network task, read by the log task
+
+void initApiConnections() {
+	for (uint8_t i = 0; i < NUM_API_CONNECTIONS; i++) {
+		#ifndef DISABLECERTCHECK
+		if (strcmp(apiConnections[i].host, GRAPH_API_HOST) == 0) {
+			apiConnections[i].client.setCACert(rootCACertificateGraph);
+		} else {
+			apiConnections[i].client.setCACert(rootCACertificateLogin);
+		}
+		#endif
+		apiConnections[i].https.setReuse(true);
+		apiConnections[i].https.collectHeaders(headerKeys, 1);
+	}
+}
 
-	#ifndef DISABLECERTCHECK
-	if (url.indexOf("graph.microsoft.com") > -1) {
-		client->setCACert(rootCACertificateGraph);
-	} else {
-		client->setCACert(rootCACertificateLogin);
+ApiConnection* getApiConnection(String url) {
+	for (uint8_t i = 0; i < NUM_API_CONNECTIONS; i++) {
+		if (url.indexOf(apiConnections[i].host) > -1) {
+			return &apiConnections[i];
+		}
 	}
-	#endif
+	return NULL;
+}
 
-	// HTTPClient
-	HTTPClient https;
 
-	// Prepare empty response
-	const int emptyCapacity = JSON_OBJECT_SIZE(1);
-	DynamicJsonDocument emptyDoc(emptyCapacity);
+/**
+ * API request handler
+ */
+// Callback that reads the response body from the connection
+typedef std::function<boolean(Stream& body)> ResponseParser;
+
+boolean requestApi(ResponseParser parser, String url, String payload = "", String type = "POST", boolean sendAuth = false) {
+	ApiConnection* conn = getApiConnection(url);
+	if (conn == NULL) {
+		Serial.printf("[HTTPS] No connection for host: %s\n", url.c_str());
+		return false;
+	}
+	HTTPClient& https = conn->https;
+	unsigned long tsStart = millis();
+	unsigned long tsStartMicros = micros();
+	boolean reused = conn->client.connected();
+	httpsLastCode = HTTPC_ERROR_CONNECTION_REFUSED;
+
+	// New connection: connect once here to measure it (DNS lookup, TCP connect and TLS handshake),
+	// the client reuses the connection. A failed connect is not tried again by the client.
+	if (!reused) {
+		unsigned long tsConnect = micros();
+		if (!conn->client.connect(conn->host, 443, HTTPS_CONNECT_TIMEOUT)) {
+			LOG_WARN("[HTTPS] Unable to connect to %s", conn->host);
+			return false;
+		}
+		recordHistogram(metricConnect, micros() - tsConnect);
+	}
 
 	// DBG_PRINT("[HTTPS] begin...\n");
-    if (https.begin(*client, url)) {  // HTTPS
-		https.setConnectTimeout(10000);
-		https.setTimeout(10000);
-		https.useHTTP10(true);
+	if (https.begin(conn->client, url)) {  // HTTPS
+		https.setConnectTimeout(HTTPS_CONNECT_TIMEOUT);
+		https.setTimeout(HTTPS_TIMEOUT);
 
 		// Send auth header?
 		if (sendAuth) {
-			String header = "Bearer " +  access_token;
+			String header = "Bearer ";
+			header += access_token;
 			https.addHeader("Authorization", header);
-			Serial.printf("[HTTPS] Auth token valid for %d s.\n", getTokenLifetime());
+			LOG_DEBUG("[HTTPS] Auth token valid for %d s.", getTokenLifetime());
 		}
 
 		// Start connection and send HTTP header
 		int httpCode = 0;
+		unsigned long tsRequest = micros();
 		if (type == "POST") {
+			https.addHeader("Content-Type", payload.startsWith("{") ? "application/json" : "application/x-www-form-urlencoded");
 			httpCode = https.POST(payload);
 		} else {
 			httpCode = https.GET();
 		}
+		httpsLastCode = httpCode;
+
+		// Update connection statistics
+		httpsRequests++;
+		if (!reused) {
+			httpsHandshakes++;
+		}
 
 		// httpCode will be negative on error
 		if (httpCode > 0) {
 			// HTTP header has been send and Server response header has been handled
-			Serial.printf("[HTTPS] Method: %s, Response code: %d\n", type.c_str(), httpCode);
+			recordHistogram(metricTtfb, micros() - tsRequest);
+			LOG_INFO("[HTTPS] Method: %s, Response code: %d, Connection reused: %d", type == "POST" ? "POST" : "GET", httpCode, reused);
 
 			// Just for debugging purposes:
 			// if (url.indexOf("presence") > 0) {
-			// 	Serial.println(client->readString());
+			// 	Serial.println(conn->client.readString());
 			// }
 
 			// File found at server (HTTP 200, 301), or HTTP 400 with response payload
 			if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY || httpCode == HTTP_CODE_BAD_REQUEST) {
-				// Parse JSON data
-				DeserializationError error = deserializeJson(doc, *client);
-				client->stop();
-				delete client;
-				client = NULL;
-				
-				if (error) {
-					DBG_PRINT(F("deserializeJson() failed: "));
-					DBG_PRINTLN(error.c_str());
-					https.end();
-					return false;
-				} else {
-					https.end();
-					return true;
+				// Parse body, it has to be decoded if sent with chunked transfer encoding
+				unsigned long tsParse = micros();
+				BodyStream body(conn->client, https.getSize(), https.header("Transfer-Encoding").equalsIgnoreCase("chunked"), HTTPS_TIMEOUT);
+				boolean success = parser(body);
+				recordHistogram(metricParse, micros() - tsParse);
+
+				// The parser may stop before the end of the body (e.g. the last chunk), the connection
+				// only stays open for the next request if nothing of this response is left on it
+				boolean complete = body.drain(HTTPS_DRAIN_LIMIT);
+				https.end();
+				httpsLastLatency = millis() - tsStart;
+				httpsTotalLatency += httpsLastLatency;
+				recordHistogram(metricTotal, micros() - tsStartMicros);
+
+				if (!success || !complete) {
+					conn->client.stop();
 				}
+				return success;
 			} else {
-				Serial.printf("[HTTPS] Other HTTP code: %d\nResponse: ", httpCode);
-				DBG_PRINTLN(https.getString());
+				// The body is read in every build, the connection can only be reused once it is consumed
+				BodyStream body(conn->client, https.getSize(), https.header("Transfer-Encoding").equalsIgnoreCase("chunked"), HTTPS_TIMEOUT);
+				size_t length = body.readBody(httpsErrorBody, sizeof(httpsErrorBody) - 1);
+				httpsErrorBody[length] = 0;
+				boolean complete = body.drain(HTTPS_DRAIN_LIMIT);
+				LOG_WARN("[HTTPS] Other HTTP code: %d, response: %s", httpCode, httpsErrorBody);
 				https.end();
+				recordHistogram(metricTotal, micros() - tsStartMicros);
+
+				if (!complete) {
+					conn->client.stop();
+				}
 				return false;
 			}
 		} else {
-			Serial.printf("[HTTPS] Request failed: %s\n", https.errorToString(httpCode).c_str());
+			LOG_WARN("[HTTPS] Request failed: %d", httpCode);
 			https.end();
+			conn->client.stop();
 			return false;
 		}
-    } else {
-    	DBG_PRINTLN(F("[HTTPS] Unable to connect"));
+	} else {
+		DBG_PRINTLN(F("[HTTPS] Unable to connect"));
 		return false;
-    }
+	}
+}
+
+// Request and parse JSON response, optionally keeping only the fields given in the filter document
+boolean requestJsonApi(JsonDocument& doc, String url, String payload = "", size_t capacity = 0, String type = "POST", boolean sendAuth = false, const JsonDocument* filter = NULL) {
+	return requestApi([&doc, filter](Stream& body) {
+		DeserializationError error;
+		if (filter) {
+			error = deserializeJson(doc, body, DeserializationOption::Filter(*filter));
+		} else {
+			error = deserializeJson(doc, body);
+		}
+		if (error) {
+			DBG_PRINT(F("deserializeJson() failed: "));
+			DBG_PRINTLN(error.c_str());
+			return false;
+		}
+		return true;
+	}, url, payload, type, sendAuth);
+}
+
+// Request and copy the given top level fields of the JSON response into their buffers
+boolean requestJsonFields(JsonStreamField* fields, uint8_t numFields, String url, String payload = "", String type = "POST", boolean sendAuth = false) {
+	return requestApi([fields, numFields](Stream& body) {
+		JsonStreamReader reader(body);
+		if (!reader.readFields(fields, numFields)) {
+			DBG_PRINTLN(F("readFields() failed"));
+			return false;
+		}
+		return true;
+	}, url, payload, type, sendAuth);
+}
+
+
+/**
+ * Network task
+ */
+// Outbound API requests run in their own task, so the web server and the captive portal stay
+// responsive while a request is in flight. Only one job runs at a time: its request function runs
+// in the network task, reads only the URL and payload copied for the job and only writes the response
+// buffers owned by the job, its completion function runs in loop() and updates the application state.
+#ifndef NETWORK_TASK_STACK
+#define NETWORK_TASK_STACK 8192					// Stack size of the network task, TLS needs a lot of it (if not set via build flags)
+#endif
+#ifndef NETWORK_URL_LEN
+#define NETWORK_URL_LEN (STRING_LEN + 64)		// Max. URL length of a job, the tenant is the only variable part (if not set via build flags)
+#endif
+#define NETWORK_PAYLOAD_LEN (REFRESH_TOKEN_LEN + 256)	// Max. payload length of a job, the token refresh sends the longest one
+#ifndef NETWORK_TEST_DELAY
+#define NETWORK_TEST_DELAY 0					// Delay (ms) added to every request to simulate a slow upstream (if not set via build flags)
+#endif
+
+typedef boolean (*NetworkRequest)(const char* url, const char* payload);
+typedef void (*NetworkCompletion)(boolean success);
+
+struct NetworkJob {
+	NetworkRequest request;
+	NetworkCompletion complete;
+	boolean success;
+	uint32_t duration;
+};
+
+TaskHandle_t TaskNetwork = NULL;
+QueueHandle_t networkJobQueue = NULL;
+QueueHandle_t networkResultQueue = NULL;
+boolean networkBusy = false;
+
+// URL and payload of the job in flight, only written by startNetworkJob() while no job runs
+char networkJobUrl[NETWORK_URL_LEN];
+char networkJobPayload[NETWORK_PAYLOAD_LEN];
+
+// Network task statistics
+uint32_t networkJobs = 0;
+uint32_t networkLastJobTime = 0;
+uint32_t networkMaxJobTime = 0;
+
+void networkTask(void * parameter) {
+	NetworkJob job;
+	for (;;) {
+		if (xQueueReceive(networkJobQueue, &job, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		unsigned long tsStart = millis();
+		#if NETWORK_TEST_DELAY > 0
+		vTaskDelay(NETWORK_TEST_DELAY / portTICK_PERIOD_MS);
+		#endif
+		job.success = job.request(networkJobUrl, networkJobPayload);
+		job.duration = millis() - tsStart;
+		xQueueSend(networkResultQueue, &job, portMAX_DELAY);
+	}
+}
+
+void initNetworkTask() {
+	networkJobQueue = xQueueCreate(1, sizeof(NetworkJob));
+	networkResultQueue = xQueueCreate(1, sizeof(NetworkJob));
+	xTaskCreatePinnedToCore(
+		networkTask,
+		"Network",
+		NETWORK_TASK_STACK,
+		NULL,
+		1,
+		&TaskNetwork,
+		1);
+}
+
+// Start a job with a copy of its URL and payload, returns false if another one is still in flight
+boolean startNetworkJob(NetworkRequest request, NetworkCompletion complete, const String& url, const String& payload = "") {
+	if (networkBusy) {
+		return false;
+	}
+	if (url.length() >= sizeof(networkJobUrl) || payload.length() >= sizeof(networkJobPayload)) {
+		LOG_ERROR("startNetworkJob() - Request too long, URL: %u, payload: %u", url.length(), payload.length());
+		return false;
+	}
+	strlcpy(networkJobUrl, url.c_str(), sizeof(networkJobUrl));
+	strlcpy(networkJobPayload, payload.c_str(), sizeof(networkJobPayload));
+	NetworkJob job = { request, complete, false, 0 };
+	networkBusy = xQueueSend(networkJobQueue, &job, 0) == pdTRUE;
+	return networkBusy;
+}
+
+// Run the completion of a finished job, called from loop()
+void handleNetworkResults() {
+	NetworkJob job;
+	if (xQueueReceive(networkResultQueue, &job, 0) != pdTRUE) {
+		return;
+	}
+	networkBusy = false;
+	networkJobs++;
+	networkLastJobTime = job.duration;
+	if (job.duration > networkMaxJobTime) {
+		networkMaxJobTime = job.duration;
+	}
+	job.complete(job.success);
 }
 
 
@@ -103,114 +323,88 @@ boolean requestJsonApi(JsonDocument& doc, String url, String payload = "", size_
  */
 
 // Requests to /
+// Fill in the placeholders of ROOT_PAGE_TEMPLATE
+bool rootPagePlaceholder(PageWriter& page, const char* name) {
+	if (strcmp(name, "VERSION") == 0) {
+		page.print(VERSION);
+	} else if (strcmp(name, "LOGIN_STATE") == 0) {
+		if (strlen(paramTenantValue) == 0 || strlen(paramClientIdValue) == 0) {
+			page.print("<p class=\"note nes-text is-error\">Some settings are missing. Go to <a href=\"config\">configuration page</a> to complete setup.</p></div>");
+		} else {
+			if (strlen(access_token) == 0) {
+				page.print("<p class=\"note nes-text is-error\">No authentication infos found, start device login flow to complete widget setup!</p></div>");
+			} else {
+				page.print("<p class=\"note nes-text\">Device setup complete, but you can start the device login flow if you need to re-authenticate.</p></div>");
+			}
+			page.print("<div><button type=\"button\" class=\"nes-btn\" onclick=\"openDeviceLoginModal()\">Start device login</button></div>");
+		}
+	} else if (strcmp(name, "CLIENT_ID") == 0) {
+		page.printEscaped(paramClientIdValue);
+	} else if (strcmp(name, "TENANT") == 0) {
+		page.printEscaped(paramTenantValue);
+	} else if (strcmp(name, "POLL_INTERVAL") == 0) {
+		page.printEscaped(paramPollIntervalValue);
+	} else if (strcmp(name, "NUM_LEDS") == 0) {
+		page.printEscaped(paramNumLedsValue);
+	} else if (strcmp(name, "SEGMENTS") == 0) {
+		page.printEscaped(paramSegmentsValue);
+	} else if (strcmp(name, "SKETCH_FREE") == 0) {
+		page.print(ESP.getFreeSketchSpace() - ESP.getSketchSize());
+	} else if (strcmp(name, "SKETCH_SPACE") == 0) {
+		page.print(ESP.getFreeSketchSpace());
+	} else if (strcmp(name, "SKETCH_SIZE") == 0) {
+		page.print(ESP.getSketchSize());
+	} else if (strcmp(name, "HEAP_FREE") == 0) {
+		page.print(ESP.getFreeHeap());
+	} else if (strcmp(name, "HEAP_USED") == 0) {
+		page.print(327680 - ESP.getFreeHeap());
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void sendPageChunk(const char* data, size_t length) {
+	server.sendContent_P(data, length);
+}
+
 void handleRoot() {
 	DBG_PRINTLN("handleRoot()");
 	// -- Let IotWebConf test and handle captive portal requests.
 	if (iotWebConf.handleCaptivePortal()) { return; }
 
-	String s = "<!DOCTYPE html>\n<html lang=\"en\">\n<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1, user-scalable=no\"/>";
-	s += "<link href=\"https://fonts.googleapis.com/css?family=Press+Start+2P\" rel=\"stylesheet\">";
-	s += "<link href=\"https://unpkg.com/nes.css@2.3.0/css/nes.min.css\" rel=\"stylesheet\" />";
-	s += "<style type=\"text/css\">\n";
-	s += "  body {padding:3.5rem}\n";
-	s += "  .ml-s {margin-left:1.0rem}\n";
-	s += "  .mt-s {margin-top:1.0rem}\n";
-	s += "  .mt {margin-top:3.5rem}\n";
-	s += "  #dialog-devicelogin {max-width:800px}\n";
-	s += "</style>\n";
-	s += "<script>\n";
-	s += "function closeDeviceLoginModal() {\n";
-	s += "  document.getElementById('dialog-devicelogin').close();\n";
-	s += "}\n";
-	s += "function performClearSettings() {\n";
-	s += "  fetch('/api/clearSettings').then(r => r.json()).then(data => {\n";
-	s += "    console.log('clearSettings', data);\n";
-	s += "    document.getElementById('dialog-clearsettings').close();\n";
-	s += "    document.getElementById('dialog-clearsettings-result').showModal();\n";
-	s += "  });\n";
-	s += "}\n";
-	s += "function openDeviceLoginModal() {\n";
-	s += "  fetch('/api/startDevicelogin').then(r => r.json()).then(data => {\n";
-	s += "    console.log('startDevicelogin', data);\n";
-	s += "    if (data && data.user_code) {\n";
-	s += "      document.getElementById('btn_open').href = data.verification_uri;\n";
-	s += "      document.getElementById('lbl_message').innerText = data.message;\n";
-	s += "      document.getElementById('code_field').value = data.user_code;\n";
-	s += "    }\n";
-	s += "    document.getElementById('dialog-devicelogin').showModal();\n";
-	s += "  });\n";
-	s += "}\n";
-	s += "</script>\n";
-	s += "<title>ESP32 teams presence</title></head>\n";
-	s += "<body><h2>ESP32 teams presence - v" + String(VERSION) + "</h2>";
-
-	s += "<section class=\"mt\"><div class=\"nes-balloon from-left\">";
-	if (strlen(paramTenantValue) == 0 || strlen(paramClientIdValue) == 0) {
-		s += "<p class=\"note nes-text is-error\">Some settings are missing. Go to <a href=\"config\">configuration page</a> to complete setup.</p></div>";
-	} else {
-		if (access_token == "") {
-			s += "<p class=\"note nes-text is-error\">No authentication infos found, start device login flow to complete widget setup!</p></div>";
-		} else {
-			s += "<p class=\"note nes-text\">Device setup complete, but you can start the device login flow if you need to re-authenticate.</p></div>";
-		}
-		s += "<div><button type=\"button\" class=\"nes-btn\" onclick=\"openDeviceLoginModal()\">Start device login</button></div>";
-	}
-	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-devicelogin\">\n";
-	s += "<p class=\"title\">Start device login</p>\n";
-	s += "<p id=\"lbl_message\"></p>\n";
-	s += "<input type=\"text\" id=\"code_field\" class=\"nes-input\" disabled>\n";
-	s += "<menu class=\"dialog-menu\">\n";
-	s += "<button id=\"btn_close\" class=\"nes-btn\" onclick=\"closeDeviceLoginModal()\">Close</button>\n";
-	s += "<a class=\"nes-btn is-primary ml-s\" id=\"btn_open\" href=\"https://microsoft.com/devicelogin\" target=\"_blank\">Open device login</a>\n";
-	s += "</menu>\n";
-	s += "</dialog>\n";
-	s += "</section>\n";
-
-	s += "<div class=\"nes-balloon from-left mt\">";
-	s += "Go to <a href=\"config\">configuration page</a> to change settings.";
-	s += "</div>";
-	s += "<section class=\"nes-container with-title\"><h3 class=\"title\">Current settings</h3>";
-	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Client-ID</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramClientIdValue) +  "\"></div>";
-	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Tenant hostname / ID</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramTenantValue) +  "\"></div>";
-	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Polling interval (sec)</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramPollIntervalValue) +  "\"></div>";
-	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Number of LEDs</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramNumLedsValue) +  "\"></div>";
-	s += "</section>";
-
-	s += "<section class=\"nes-container with-title mt\"><h3 class=\"title\">Memory usage</h3>";
-	s += "<div>Sketch: " + String(ESP.getFreeSketchSpace() - ESP.getSketchSize()) + " of " + String(ESP.getFreeSketchSpace()) + " bytes free</div>";
-	s += "<progress class=\"nes-progress\" value=\"" + String(ESP.getSketchSize()) + "\" max=\"" + String(ESP.getFreeSketchSpace()) + "\"></progress>";
-	s += "<div class=\"mt-s\">RAM: " + String(ESP.getFreeHeap()) + " of 327680 bytes free</div>";
-	s += "<progress class=\"nes-progress\" value=\"" + String(327680 - ESP.getFreeHeap()) + "\" max=\"327680\"></progress>";
-	s += "</section>";
-
-	s += "<section class=\"nes-container with-title mt\"><h3 class=\"title\">Danger area</h3>";
-	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-clearsettings\">\n";
-	s += "<p class=\"title\">Really clear all settings?</p>\n";
-	s += "<button class=\"nes-btn\" onclick=\"document.getElementById('dialog-clearsettings').close()\">Close</button>\n";
-	s += "<button class=\"nes-btn is-error\" onclick=\"performClearSettings()\">Clear all settings</button>\n";
-	s += "</dialog>\n";
-	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-clearsettings-result\">\n";
-	s += "<p class=\"title\">All settings were cleared.</p>\n";
-	s += "</dialog>\n";
-	s += "<div><button type=\"button\" class=\"nes-btn is-error\" onclick=\"document.getElementById('dialog-clearsettings').showModal();\">Clear all settings</button></div>";
-	s += "</section>";
-
-	s += "<div class=\"mt\"><i class=\"nes-icon github\"></i> Find the <a href=\"https://github.com/toblum/ESPTeamsPresence\" target=\"_blank\">ESPTeamsPresence</a> project on GitHub.</i></div>";
-
-	s += "</body>\n</html>\n";
-
-	server.send(200, "text/html", s);
+	uint32_t heapBefore = ESP.getFreeHeap();
+
+	// Stream the page with chunked transfer encoding, memory use is bounded by the chunk buffer
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/html", "");
+	PageWriter page(sendPageChunk);
+	page.render(ROOT_PAGE_TEMPLATE, rootPagePlaceholder);
+	page.flush();
+	server.sendContent("");
+
+	LOG_DEBUG("handleRoot() - %u bytes sent, free heap %u -> %u", page.bytesWritten(), heapBefore, ESP.getFreeHeap());
 }
 
 void handleGetSettings() {
 	DBG_PRINTLN("handleGetSettings()");
 	
-	const int capacity = JSON_OBJECT_SIZE(13);
+	// Strings are stored as pointers to the config buffers (const char*), so only the members need room
+	const int capacity = JSON_OBJECT_SIZE(64);
 	StaticJsonDocument<capacity> responseDoc;
-	responseDoc["client_id"].set(paramClientIdValue);
-	responseDoc["tenant"].set(paramTenantValue);
-	responseDoc["poll_interval"].set(paramPollIntervalValue);
-	responseDoc["num_leds"].set(paramNumLedsValue);
+	responseDoc["client_id"].set((const char*)paramClientIdValue);
+	responseDoc["tenant"].set((const char*)paramTenantValue);
+	responseDoc["poll_interval"].set((const char*)paramPollIntervalValue);
+	responseDoc["poll_interval_max"].set((const char*)paramPollIntervalMaxValue);
+	responseDoc["working_hours"].set((const char*)paramWorkingHoursValue);
+	responseDoc["poll_interval_current"].set(pollScheduler.interval);
+	responseDoc["poll_requests_per_hour"].set(getRequestsPerHour(pollScheduler));
+	responseDoc["poll_detection_latency"].set(getAverageDetectionLatency(pollScheduler));
+	responseDoc["num_leds"].set((const char*)paramNumLedsValue);
+	responseDoc["segments"].set((const char*)paramSegmentsValue);
+	responseDoc["brightness"].set((const char*)paramBrightnessValue);
+	responseDoc["color_temperature"].set((const char*)paramColorTemperatureValue);
+	responseDoc["users"].set(numberUsers);
 
 	responseDoc["heap"].set(ESP.getFreeHeap());
 	responseDoc["min_heap"].set(ESP.getMinFreeHeap());
@@ -223,9 +417,122 @@ void handleGetSettings() {
 
     responseDoc["sketch_version"].set(VERSION);
 
+	responseDoc["https_requests"].set(httpsRequests);
+	responseDoc["https_handshakes"].set(httpsHandshakes);
+	responseDoc["https_reuse_ratio"].set(httpsRequests > 0 ? (float)(httpsRequests - httpsHandshakes) / httpsRequests : 0);
+	responseDoc["https_last_latency"].set(httpsLastLatency);
+	responseDoc["https_avg_latency"].set(httpsRequests > 0 ? httpsTotalLatency / httpsRequests : 0);
+	responseDoc["network_jobs"].set(networkJobs);
+	responseDoc["network_last_job_time"].set(networkLastJobTime);
+	responseDoc["network_max_job_time"].set(networkMaxJobTime);
+	responseDoc["loop_max_time"].set(loopMaxTime);
+
+	responseDoc["token_arena_size"].set(tokenArenaSize);
+	responseDoc["token_arena_high_water"].set(getTokenArenaHighWater());
+	responseDoc["access_token_high_water"].set(tokenSlots[TOKEN_ACCESS].highWater);
+	responseDoc["refresh_token_high_water"].set(tokenSlots[TOKEN_REFRESH].highWater);
+	responseDoc["id_token_high_water"].set(tokenSlots[TOKEN_ID].highWater);
+
+	responseDoc["context_writes"].set(contextWrites);
+	responseDoc["context_writes_skipped"].set(contextWritesSkipped);
+	responseDoc["context_sequence"].set(contextSequence);
+	responseDoc["context_load_time"].set(contextLoadTime);
+
+	responseDoc["frames_sent"].set(framesSent);
+	responseDoc["frames_skipped"].set(framesSkipped);
+	responseDoc["led_channels"].set(tx_num_channels);
+	responseDoc["led_fps"].set(ledFps);
+	responseDoc["led_frame_budget"].set(ledFrameBudget);
+	responseDoc["led_overruns"].set(ledOverruns);
+	responseDoc["led_frames_dropped"].set(ledFramesDropped);
+	responseDoc["led_jitter_max"].set(ledJitterMax);
+	responseDoc["led_stack_free"].set(ledStackFree);
+	responseDoc["idle_core0"].set(idlePercent[0]);
+	responseDoc["idle_core1"].set(idlePercent[1]);
+
+	if (responseDoc.overflowed()) {
+		LOG_ERROR("handleGetSettings() - Document too small for %u members", responseDoc.size());
+		server.send(500, "application/json", F("{\"error\": \"settings_overflow\"}"));
+		return;
+	}
 	server.send(200, "application/json", responseDoc.as<String>());
 }
 
+// Requests to /metrics, in the Prometheus text format
+void handleMetrics() {
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain; version=0.0.4", "");
+	PageWriter out(sendPageChunk);
+
+	for (Histogram* histogram : histograms) {
+		writeHistogram(out, *histogram);
+	}
+
+	writeMetric(out, "https_requests_total", "API requests", "counter", httpsRequests);
+	writeMetric(out, "https_handshakes_total", "API requests that needed a new connection", "counter", httpsHandshakes);
+	writeMetric(out, "token_refreshes_total", "Successful token refreshes", "counter", metricTokenRefreshes);
+	writeMetric(out, "token_refresh_failures_total", "Failed token refreshes", "counter", metricTokenRefreshFailures);
+	writeMetricHeader(out, "poll_failures_total", "Failed presence polls by HTTP code, negative codes are connection errors", "counter");
+	for (uint8_t i = 0; i < POLL_FAILURE_CODES && metricPollFailures[i].code != 0; i++) {
+		out.printf(METRICS_PREFIX "poll_failures_total{code=\"%d\"} %u\n", metricPollFailures[i].code, metricPollFailures[i].count);
+	}
+
+	writeMetric(out, "led_frames_sent_total", "LED frames sent", "counter", framesSent);
+	writeMetric(out, "led_frames_skipped_total", "Unchanged LED frames skipped", "counter", framesSkipped);
+	writeMetric(out, "led_overruns_total", "LED frames that took longer than their budget", "counter", ledOverruns);
+	writeMetric(out, "led_frames_dropped_total", "LED frame slots missed because of overruns", "counter", ledFramesDropped);
+	writeMetric(out, "led_fps", "LED frames scheduled during the last second", "gauge", ledFps);
+	writeMetric(out, "led_stack_free_bytes", "Least free stack of the LED task", "gauge", ledStackFree);
+	writeMetricHeader(out, "led_frame_budget_seconds", "Current LED frame period", "gauge");
+	out.printf(METRICS_PREFIX "led_frame_budget_seconds %u.%03u\n", ledFrameBudget / 1000, ledFrameBudget % 1000);
+	writeMetric(out, "context_writes_total", "Context writes to flash", "counter", contextWrites);
+	writeMetric(out, "log_dropped_total", "Log messages dropped because the log buffer was full", "counter", logDropped);
+
+	writeMetric(out, "heap_free_bytes", "Free heap", "gauge", ESP.getFreeHeap());
+	writeMetric(out, "heap_free_low_water_bytes", "Lowest free heap seen", "gauge", ESP.getMinFreeHeap());
+	writeMetric(out, "heap_largest_block_low_water_bytes", "Smallest largest free heap block seen", "gauge", metricLargestBlockLowWater);
+	writeMetric(out, "uptime_seconds", "Time since boot", "counter", uptimeMs() / 1000);
+
+	out.flush();
+	server.sendContent("");
+}
+
+// Requests to /api/log, the most recent log messages
+void handleGetLog() {
+	uint32_t end = __atomic_load_n(&logHistoryEnd, __ATOMIC_ACQUIRE);
+	uint32_t start = end > LOG_HISTORY_SIZE ? end - LOG_HISTORY_SIZE : 0;
+
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain", "");
+	PageWriter out(sendPageChunk);
+	// The oldest line may be cut, it is overwritten first
+	for (uint32_t pos = start; pos < end; ) {
+		uint32_t offset = pos % LOG_HISTORY_SIZE;
+		uint32_t length = min(end - pos, (uint32_t)LOG_HISTORY_SIZE - offset);
+		out.write(logHistory + offset, length);
+		pos += length;
+	}
+	out.flush();
+	server.sendContent("");
+}
+
+#if LED_CAPTURE_BYTES > 0
+// Requests to /api/frames, captured LED frames as PPM image (one row per frame) or with ?format=ansi as terminal colours
+void handleGetFrames() {
+	bool ansi = server.arg("format") == "ansi";
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, ansi ? "text/plain" : "image/x-portable-pixmap", "");
+	PageWriter out(sendPageChunk);
+	if (ansi) {
+		writeFramesAnsi(out, frameCapture);
+	} else {
+		writeFramesPpm(out, frameCapture);
+	}
+	out.flush();
+	server.sendContent("");
+}
+#endif
+
 // Delete EEPROM by removing the trailing sequence, remove context file
 void handleClearSettings() {
 	DBG_PRINTLN("handleClearSettings()");
@@ -279,42 +586,80 @@ boolean formValidator() {
 // Config was saved
 void onConfigSaved() {
 	DBG_PRINTLN(F("Configuration was updated."));
-	ws2812fx.setLength(atoi(paramNumLedsValue));
+	numberLeds = atoi(paramNumLedsValue);
+	if (numberLeds < 1) {
+		numberLeds = NUMLEDS;
+	}
+	ws2812fx.setLength(numberLeds);
+	initFrameCapture(ws2812fx);
+	initColorPipeline();
+	// configTzTime() only runs when WiFi connects, working hours use the new zone right away
+	setenv("TZ", paramTimezoneValue, 1);
+	tzset();
+	initSegments();
+	initUsers();
+	initPolling();
+	// Poll presence right away to restore the animations on the new segments
+	tsPolling = uptimeMs();
+}
+
+// Device code response, written by the network task
+StaticJsonDocument<JSON_OBJECT_SIZE(6) + 540> deviceCodeDoc;
+#define DEVICELOGIN_IDLE 0			// No device code requested
+#define DEVICELOGIN_REQUESTED 1		// Device code request is in flight
+#define DEVICELOGIN_READY 2			// Device code received, not yet sent to the browser
+#define DEVICELOGIN_FAILED 3		// Device code request failed, not yet sent to the browser
+uint8_t deviceLoginStatus = DEVICELOGIN_IDLE;
+
+// Request devicelogin context (runs in the network task)
+boolean requestDeviceCode(const char* url, const char* payload) {
+	return requestJsonApi(deviceCodeDoc, url, payload, deviceCodeDoc.capacity());
 }
 
-// Requests to /startDevicelogin
+void onDeviceCode(boolean res) {
+	if (res && deviceCodeDoc.containsKey("device_code") && deviceCodeDoc.containsKey("user_code") && deviceCodeDoc.containsKey("interval") && deviceCodeDoc.containsKey("verification_uri") && deviceCodeDoc.containsKey("message")) {
+		// Save device_code, user_code and interval
+		device_code = deviceCodeDoc["device_code"].as<String>();
+		user_code = deviceCodeDoc["user_code"].as<String>();
+		interval = deviceCodeDoc["interval"].as<unsigned int>();
+
+		// Set state, update polling timestamp
+		state = SMODEDEVICELOGINSTARTED;
+		tsPolling = uptimeMs() + (interval * 1000);
+		deviceLoginStatus = DEVICELOGIN_READY;
+	} else {
+		deviceLoginStatus = DEVICELOGIN_FAILED;
+	}
+}
+
+// Requests to /startDevicelogin, answers 202 while the device code is requested, the browser asks again
 void handleStartDevicelogin() {
-	// Only if not already started
-	if (state != SMODEDEVICELOGINSTARTED) {
+	if (deviceLoginStatus == DEVICELOGIN_READY) {
+		deviceLoginStatus = DEVICELOGIN_IDLE;
+
+		// Prepare response JSON
+		const size_t responseCapacity = JSON_OBJECT_SIZE(3);
+		DynamicJsonDocument responseDoc(responseCapacity);
+		responseDoc["user_code"] = deviceCodeDoc["user_code"].as<const char*>();
+		responseDoc["verification_uri"] = deviceCodeDoc["verification_uri"].as<const char*>();
+		responseDoc["message"] = deviceCodeDoc["message"].as<const char*>();
+
+		// Send JSON response
+		server.send(200, "application/json", responseDoc.as<String>());
+	} else if (deviceLoginStatus == DEVICELOGIN_FAILED) {
+		deviceLoginStatus = DEVICELOGIN_IDLE;
+		server.send(500, "application/json", F("{\"error\": \"devicelogin_unknown_response\"}"));
+	} else if (deviceLoginStatus == DEVICELOGIN_REQUESTED) {
+		server.send(202, "application/json", F("{\"status\": \"pending\"}"));
+	} else if (state != SMODEDEVICELOGINSTARTED) {
+		// Only if not already started, a busy network task is tried again with the next request
 		DBG_PRINTLN(F("handleStartDevicelogin()"));
-
-		// Request devicelogin context
-		const size_t capacity = JSON_OBJECT_SIZE(6) + 540;
-		DynamicJsonDocument doc(capacity);
-		boolean res = requestJsonApi(doc, "https://login.microsoftonline.com/" + String(paramTenantValue) + "/oauth2/v2.0/devicecode", "client_id=" + String(paramClientIdValue) + "&scope=offline_access%20openid%20Presence.Read", capacity);
-
-		if (res && doc.containsKey("device_code") && doc.containsKey("user_code") && doc.containsKey("interval") && doc.containsKey("verification_uri") && doc.containsKey("message")) {
-			// Save device_code, user_code and interval
-			device_code = doc["device_code"].as<String>();
-			user_code = doc["user_code"].as<String>();
-			interval = doc["interval"].as<unsigned int>();
-
-			// Prepare response JSON
-			const size_t responseCapacity = JSON_OBJECT_SIZE(3);
-			DynamicJsonDocument responseDoc(responseCapacity);
-			responseDoc["user_code"] = doc["user_code"].as<const char*>();
-			responseDoc["verification_uri"] = doc["verification_uri"].as<const char*>();
-			responseDoc["message"] = doc["message"].as<const char*>();
-
-			// Set state, update polling timestamp
-			state = SMODEDEVICELOGINSTARTED;
-			tsPolling = millis() + (interval * 1000);
-
-			// Send JSON response
-			server.send(200, "application/json", responseDoc.as<String>());
-		} else {
-			server.send(500, "application/json", F("{\"error\": \"devicelogin_unknown_response\"}"));
+		String url = "https://login.microsoftonline.com/" + String(paramTenantValue) + "/oauth2/v2.0/devicecode";
+		String payload = "client_id=" + String(paramClientIdValue) + "&scope=offline_access%20openid%20Presence.Read" + String(numberUsers > 0 ? "%20Presence.Read.All" : "");
+		if (startNetworkJob(requestDeviceCode, onDeviceCode, url, payload)) {
+			deviceLoginStatus = DEVICELOGIN_REQUESTED;
 		}
+		server.send(202, "application/json", F("{\"status\": \"pending\"}"));
 	} else {
 		server.send(409, "application/json", F("{\"error\": \"devicelogin_already_running\"}"));
 	}
@@ -23,6 +23,100 @@ bool exists(String path) {
 	return yes;
 }
 
+/**
+ * File index
+ *
+ * Served files are indexed in RAM at boot (and on upload / delete), so a request
+ * costs one lookup and a revalidated request does not touch the flash at all.
+ */
+#ifndef FILE_INDEX_SIZE
+#define FILE_INDEX_SIZE 32						// Max. number of indexed files (if not set via build flags)
+#endif
+#ifndef FILE_CACHE_CONTROL
+#define FILE_CACHE_CONTROL "no-cache"			// Cache-Control header of served files, browsers revalidate with the ETag (if not set via build flags)
+#endif
+#define FILE_PATH_LEN 32						// Max. path length in SPIFFS, including the terminating zero
+
+struct FileIndexEntry {
+	char path[FILE_PATH_LEN];	// Path as requested, without .gz
+	boolean gz;					// Serve the .gz variant
+	uint32_t size;				// Size of the served variant
+	uint32_t crc;				// CRC32 of the served variant
+};
+
+FileIndexEntry fileIndex[FILE_INDEX_SIZE];
+uint8_t fileIndexCount = 0;
+boolean fileIndexOverflow = false;
+
+FileIndexEntry* findFileIndexEntry(const char* path) {
+	for (uint8_t i = 0; i < fileIndexCount; i++) {
+		if (strcmp(fileIndex[i].path, path) == 0) {
+			return &fileIndex[i];
+		}
+	}
+	return NULL;
+}
+
+// Calculate size and CRC32 of a file, returns false if it does not exist
+bool hashFile(const String& path, uint32_t& size, uint32_t& crc) {
+	File file = SPIFFS.open(path, "r");
+	if (!file || file.isDirectory()) {
+		return false;
+	}
+	uint8_t buffer[256];
+	size = 0;
+	crc = 0;
+	size_t length;
+	while ((length = file.read(buffer, sizeof(buffer))) > 0) {
+		crc = crc32_le(crc, buffer, length);
+		size += length;
+	}
+	file.close();
+	return true;
+}
+
+// Re-read the index entry of a path (with or without .gz) from flash
+void updateFileIndex(String path) {
+	if (path.endsWith(".gz")) {
+		path.remove(path.length() - 3);
+	}
+	if (path.length() >= FILE_PATH_LEN) {
+		return;
+	}
+
+	FileIndexEntry entry;
+	strcpy(entry.path, path.c_str());
+	entry.gz = hashFile(path + ".gz", entry.size, entry.crc);
+	boolean found = entry.gz || hashFile(path, entry.size, entry.crc);
+
+	FileIndexEntry* existing = findFileIndexEntry(entry.path);
+	if (!found) {
+		if (existing) {
+			*existing = fileIndex[--fileIndexCount];
+		}
+	} else if (existing) {
+		*existing = entry;
+	} else if (fileIndexCount < FILE_INDEX_SIZE) {
+		fileIndex[fileIndexCount++] = entry;
+	} else {
+		fileIndexOverflow = true;
+	}
+}
+
+void buildFileIndex() {
+	fileIndexCount = 0;
+	fileIndexOverflow = false;
+	File root = SPIFFS.open("/");
+	File file = root.openNextFile();
+	while (file) {
+		String path = file.name();
+		file.close();
+		updateFileIndex(path);
+		file = root.openNextFile();
+	}
+	Serial.printf("buildFileIndex() - %d files indexed%s\n", fileIndexCount, fileIndexOverflow ? ", index full" : "");
+}
+
 void handleMinimalUpload() {
 	server.sendHeader("Access-Control-Allow-Origin", "*");
 	server.send(200, "text/html", F("<!DOCTYPE html>\
@@ -43,10 +137,61 @@ void handleMinimalUpload() {
 			</html>"));
 }
 
+/**
+ * File upload
+ *
+ * Uploads are collected in a buffer of whole SPIFFS pages and written to a temp file, which
+ * replaces the target only after the upload is complete and its CRC was verified.
+ */
+#ifndef UPLOAD_BUFFER_SIZE
+#define UPLOAD_BUFFER_SIZE 4096					// Upload write buffer, a multiple of the SPIFFS page size (256) (if not set via build flags)
+#endif
+#define UPLOAD_TEMP_SUFFIX ".tmp"
+
+struct UploadContext {
+	File file;
+	char path[FILE_PATH_LEN];
+	char tempPath[FILE_PATH_LEN];
+	uint8_t* buffer;
+	size_t length;			// Bytes in the buffer
+	size_t size;			// Bytes received
+	uint32_t crc;			// CRC32 of the bytes received
+	unsigned long tsStart;
+	uint32_t duration;
+	const char* error;		// NULL if successful
+};
+UploadContext uploadContext;
+
+// Write the buffer to the temp file
+void flushUpload(UploadContext& u) {
+	if (u.length > 0 && u.error == NULL && u.file.write(u.buffer, u.length) != u.length) {
+		u.error = "write_failed";
+	}
+	u.length = 0;
+}
+
+void closeUpload(UploadContext& u) {
+	if (u.file) {
+		u.file.close();
+	}
+	free(u.buffer);
+	u.buffer = NULL;
+}
+
 void handleFileUpload() {
-	File fsUploadFile;
 	HTTPUpload &upload = server.upload();
+	UploadContext& u = uploadContext;
 	if (upload.status == UPLOAD_FILE_START) 	{
+		closeUpload(u);
+		u.length = 0;
+		u.size = 0;
+		u.crc = 0;
+		u.duration = 0;
+		u.error = NULL;
+		u.path[0] = 0;
+		u.tempPath[0] = 0;
+		u.tsStart = millis();
+
 		String filename = upload.filename;
 		if (!filename.startsWith("/"))
 		{
@@ -54,22 +199,101 @@ void handleFileUpload() {
 		}
 		DBG_PRINT("handleFileUpload Name: ");
 		DBG_PRINTLN(filename);
-		fsUploadFile = SPIFFS.open(filename, "w");
-		filename = String();
+		if (filename.length() + strlen(UPLOAD_TEMP_SUFFIX) >= FILE_PATH_LEN) {
+			u.error = "path_too_long";
+			return;
+		}
+		strcpy(u.path, filename.c_str());
+		snprintf(u.tempPath, sizeof(u.tempPath), "%s" UPLOAD_TEMP_SUFFIX, u.path);
+
+		u.buffer = (uint8_t*)malloc(UPLOAD_BUFFER_SIZE);
+		if (u.buffer == NULL) {
+			u.error = "out_of_memory";
+			return;
+		}
+		u.file = SPIFFS.open(u.tempPath, "w");
+		if (!u.file) {
+			u.error = "open_failed";
+		}
 	} else if (upload.status == UPLOAD_FILE_WRITE) {
-		//DBG_OUTPUT_PORT.print("handleFileUpload Data: "); DBG_OUTPUT_PORT.println(upload.currentSize);
-		if (fsUploadFile) {
-			fsUploadFile.write(upload.buf, upload.currentSize);
+		if (u.error != NULL) {
+			return;
+		}
+		u.crc = crc32_le(u.crc, upload.buf, upload.currentSize);
+		u.size += upload.currentSize;
+
+		// Fill the buffer, full buffers are written at once
+		size_t offset = 0;
+		while (offset < upload.currentSize) {
+			size_t length = min((size_t)(UPLOAD_BUFFER_SIZE - u.length), upload.currentSize - offset);
+			memcpy(u.buffer + u.length, upload.buf + offset, length);
+			u.length += length;
+			offset += length;
+			if (u.length == UPLOAD_BUFFER_SIZE) {
+				flushUpload(u);
+			}
 		}
 	} else if (upload.status == UPLOAD_FILE_END) {
-		if (fsUploadFile) {
-			fsUploadFile.close();
+		if (u.error != NULL) {
+			closeUpload(u);
+			return;
 		}
+		flushUpload(u);
+		closeUpload(u);
+
+		// Verify what ended up in flash, and the checksum of the client (if given)
+		uint32_t size;
+		uint32_t crc;
+		uint32_t expectedCrc = server.hasArg("crc") ? strtoul(server.arg("crc").c_str(), NULL, 16) : u.crc;
+		if (u.error == NULL && (!hashFile(u.tempPath, size, crc) || size != u.size || crc != u.crc || crc != expectedCrc)) {
+			u.error = "crc_mismatch";
+		}
+		if (u.error == NULL) {
+			SPIFFS.remove(u.path);
+			if (!SPIFFS.rename(u.tempPath, u.path)) {
+				u.error = "rename_failed";
+			}
+		}
+		if (u.error != NULL) {
+			SPIFFS.remove(u.tempPath);
+		}
+		u.duration = millis() - u.tsStart;
+		updateFileIndex(u.path);
+
 		DBG_PRINT("handleFileUpload Size: ");
 		DBG_PRINTLN(upload.totalSize);
+	} else if (upload.status == UPLOAD_FILE_ABORTED) {
+		u.error = "aborted";
+		closeUpload(u);
+		if (u.tempPath[0] != 0) {
+			SPIFFS.remove(u.tempPath);
+		}
 	}
 }
 
+// Response after the upload, with the throughput achieved
+void handleFileUploadDone() {
+	const UploadContext& u = uploadContext;
+	const int capacity = JSON_OBJECT_SIZE(6);
+	StaticJsonDocument<capacity> responseDoc;
+	char crc[9];
+	snprintf(crc, sizeof(crc), "%08x", u.crc);
+	responseDoc["path"].set(u.path);
+	responseDoc["size"].set(u.size);
+	responseDoc["crc"].set((const char*)crc);		// Not copied, lives until the response is sent
+	responseDoc["time_ms"].set(u.duration);
+	responseDoc["throughput"].set(u.duration > 0 ? (uint32_t)((uint64_t)u.size * 1000 / u.duration) : 0);
+	if (u.error != NULL) {
+		responseDoc["error"].set(u.error);
+	}
+	if (responseDoc.overflowed()) {
+		LOG_ERROR("handleFileUploadDone() - Document too small for %u members", responseDoc.size());
+		server.send(500, "application/json", F("{\"error\": \"response_overflow\"}"));
+		return;
+	}
+	server.send(u.error == NULL ? 200 : 500, "application/json", responseDoc.as<String>());
+}
+
 void handleFileDelete() {
 	if (server.args() == 0)	{
 		return server.send(500, "text/plain", "BAD ARGS");
@@ -83,38 +307,67 @@ void handleFileDelete() {
 		return server.send(404, "text/plain", "FileNotFound");
 	}
 	SPIFFS.remove(path);
+	updateFileIndex(path);
 	server.send(200, "text/plain", "");
 	path = String();
 }
 
+// Requests to /fs/list?dir=/[&offset=0][&limit=50][&details=1], the JSON array is streamed in chunks.
+// Returns less than limit entries at the end of the directory.
 void handleFileList() {
 	if (!server.hasArg("dir")) {
 		server.send(500, "text/plain", "BAD ARGS");
 		return;
 	}
 
+	long offsetArg = server.hasArg("offset") ? server.arg("offset").toInt() : 0;
+	long limitArg = server.hasArg("limit") ? server.arg("limit").toInt() : 0;
+	if (offsetArg < 0 || limitArg < 0) {
+		server.send(400, "text/plain", "BAD ARGS");
+		return;
+	}
+	uint32_t offset = offsetArg;
+	uint32_t limit = server.hasArg("limit") ? limitArg : UINT32_MAX;
+
 	String path = server.arg("dir");
 	DBG_PRINTLN("handleFileList: " + path);
+	boolean details = server.hasArg("details");
 
 	File root = SPIFFS.open(path);
 	path = String();
-	String output = "[";
+
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/json", "");
+	PageWriter output(sendPageChunk);
+	output.print("[");
 	if (root.isDirectory()) {
+		uint32_t index = 0;
+		uint32_t count = 0;
 		File file = root.openNextFile();
-		while (file) {
-			if (output != "[") {
-				output += ',';
+		while (file && count < limit) {
+			if (index++ >= offset) {
+				if (count++ > 0) {
+					output.print(",");
+				}
+				output.print("{\"type\":\"");
+				output.print((file.isDirectory()) ? "dir" : "file");
+				output.print("\",\"name\":\"");
+				output.print(file.name() + 1);
+				output.print("\"");
+				if (details) {
+					output.print(",\"size\":");
+					output.print((uint32_t)file.size());
+					output.print(",\"modified\":");
+					output.print((uint32_t)file.getLastWrite());
+				}
+				output.print("}");
 			}
-			output += "{\"type\":\"";
-			output += (file.isDirectory()) ? "dir" : "file";
-			output += "\",\"name\":\"";
-			output += String(file.name()).substring(1);
-			output += "\"}";
 			file = root.openNextFile();
 		}
 	}
-	output += "]";
-	server.send(200, "text/json", output);
+	output.print("]");
+	output.flush();
+	server.sendContent("");
 }
 
 String getContentType(String filename) {
@@ -153,16 +406,43 @@ bool handleFileRead(String path) {
 	if (path.endsWith("/"))	{
 		path += "index.htm";
 	}
+
 	String contentType = getContentType(path);
-	String pathWithGz = path + ".gz";
-	if (exists(pathWithGz) || exists(path))	{
-		if (exists(pathWithGz))	{
-			path += ".gz";
+	FileIndexEntry* entry = findFileIndexEntry(path.c_str());
+	if (entry != NULL) {
+		char etag[20];
+		snprintf(etag, sizeof(etag), "\"%08x-%x\"", entry->crc, entry->size);
+		// Revalidated from the index alone, without touching the flash
+		if (server.header("If-None-Match") == etag) {
+			server.sendHeader("ETag", etag);
+			server.sendHeader("Cache-Control", FILE_CACHE_CONTROL);
+			server.send(304);
+			return true;
 		}
-		File file = SPIFFS.open(path, "r");
-		server.streamFile(file, contentType);
-		file.close();
-		return true;
+		File file = SPIFFS.open(entry->gz ? path + ".gz" : path, "r");
+		if (file) {
+			server.sendHeader("ETag", etag);
+			server.sendHeader("Cache-Control", FILE_CACHE_CONTROL);
+			server.streamFile(file, contentType);
+			file.close();
+			return true;
+		}
+		// Removed behind our back
+		updateFileIndex(path);
+	}
+
+	// Not in the index (it is full or the file changed), served from flash without ETag
+	String pathWithGz = path + ".gz";
+	if (SPIFFS.exists(pathWithGz)) {
+		path = pathWithGz;
+	} else if (!SPIFFS.exists(path)) {
+		return false;
 	}
-	return false;
-}
\ No newline at end of file
+	File file = SPIFFS.open(path, "r");
+	if (!file || file.isDirectory()) {
+		return false;
+	}
+	server.streamFile(file, contentType);
+	file.close();
+	return true;
+}
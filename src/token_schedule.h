@@ -0,0 +1,57 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Token refresh schedule
+ *
+ * Deadlines are kept as 64 bit uptime in ms, which does not wrap after 49.7 days like
+ * millis() does. The access token is refreshed in the background TOKEN_PREREFRESH_TIME
+ * before it expires, while presence polling goes on with the current token. Only if that
+ * did not succeed until TOKEN_REFRESH_TIMEOUT before expiry, polling stops for a refresh.
+ * Time is passed in by the caller, like in the poll scheduler.
+ */
+#ifndef TOKEN_REFRESH_TIMEOUT
+#define TOKEN_REFRESH_TIMEOUT 60				// Number of seconds until expiration before token gets refreshed (if not set via build flags)
+#endif
+#ifndef TOKEN_PREREFRESH_TIME
+#define TOKEN_PREREFRESH_TIME 600				// Number of seconds until expiration before token gets refreshed in the background (if not set via build flags)
+#endif
+
+struct TokenSchedule {
+	uint64_t expires;		// Uptime when the access token expires (ms)
+	uint64_t nextRefresh;	// Earliest uptime for the next background refresh (ms)
+};
+
+// Seconds until the token expires, negative once it has expired
+int32_t getTokenLifetime(const TokenSchedule& s, uint64_t now) {
+	return (int64_t)(s.expires - now) / 1000;
+}
+
+// A new token was received that is valid for expiresIn seconds
+void setTokenExpiry(TokenSchedule& s, uint64_t now, uint32_t expiresIn) {
+	s.expires = now + expiresIn * 1000ULL;
+}
+
+// A background refresh failed, try again after the given number of seconds
+void delayTokenRefresh(TokenSchedule& s, uint64_t now, uint32_t seconds) {
+	s.nextRefresh = now + seconds * 1000ULL;
+}
+
+// The token should be refreshed in the background, polling goes on meanwhile
+bool isBackgroundRefreshDue(const TokenSchedule& s, uint64_t now) {
+	return getTokenLifetime(s, now) < TOKEN_PREREFRESH_TIME && now >= s.nextRefresh;
+}
+
+// The token is about to expire, polling has to wait for a refresh
+bool isTokenRefreshRequired(const TokenSchedule& s, uint64_t now) {
+	return getTokenLifetime(s, now) < TOKEN_REFRESH_TIMEOUT;
+}
@@ -0,0 +1,110 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Crossfade transitions
+ *
+ * When a segment gets a new animation, the frame shown at that moment is kept and blended
+ * into the frames of the new animation until LED_TRANSITION_TIME has passed. Blending is
+ * done in integer math with an 8 bit weight on a buffer sized for TRANSITION_MAX_LEDS, so
+ * nothing is allocated while the LED task runs.
+ */
+#ifndef LED_TRANSITION_TIME
+#define LED_TRANSITION_TIME 800					// Crossfade time between animations in ms, 0 to switch at once (if not set via build flags)
+#endif
+#ifndef TRANSITION_MAX_LEDS
+#define TRANSITION_MAX_LEDS 500					// Longest strip that gets transitions (if not set via build flags)
+#endif
+#define TRANSITION_BYTES_PER_LED 3				// GRB
+
+struct Transition {
+	uint16_t first;			// First byte of the segment in the pixel buffer
+	uint16_t end;			// Byte after the segment
+	uint32_t start;			// millis() when the transition started
+	bool active;
+};
+
+Transition transitions[MAX_NUM_SEGMENTS];
+uint8_t transitionFrom[TRANSITION_MAX_LEDS * TRANSITION_BYTES_PER_LED];	// Outgoing frame
+
+// Weight of the new frame, 0..256, eased in and out
+uint16_t getTransitionWeight(const Transition& t, uint32_t now) {
+	uint32_t elapsed = now - t.start;
+	if (elapsed >= LED_TRANSITION_TIME) {
+		return 256;
+	}
+	uint32_t x = elapsed * 256 / LED_TRANSITION_TIME;
+	return (x * x * (768 - 2 * x)) >> 16;
+}
+
+// Blend one segment, from and to the same position in both frames
+void blendTransition(const uint8_t* from, const uint8_t* pixels, uint8_t* out, size_t first, size_t end, uint16_t weight) {
+	for (size_t i = first; i < end; i++) {
+		out[i] = from[i] + (((int16_t)(pixels[i] - from[i]) * weight) >> 8);
+	}
+}
+
+bool transitionActive() {
+	for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++) {
+		if (__atomic_load_n(&transitions[i].active, __ATOMIC_ACQUIRE)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Keep the frame currently shown for a segment before it gets a new animation (LEDs first..last)
+void startTransition(uint8_t segment, uint16_t firstLed, uint16_t lastLed, const uint8_t* pixels) {
+	if (LED_TRANSITION_TIME == 0 || segment >= MAX_NUM_SEGMENTS || lastLed >= TRANSITION_MAX_LEDS) {
+		return;
+	}
+	Transition& t = transitions[segment];
+	size_t first = firstLed * TRANSITION_BYTES_PER_LED;
+	size_t end = (lastLed + 1) * TRANSITION_BYTES_PER_LED;
+	uint32_t now = millis();
+	if (__atomic_exchange_n(&t.active, false, __ATOMIC_ACQ_REL) && t.first == first && t.end == end) {
+		// Interrupted transition, start from what is shown right now
+		blendTransition(transitionFrom, pixels, transitionFrom, first, end, getTransitionWeight(t, now));
+	} else {
+		memcpy(transitionFrom + first, pixels + first, end - first);
+	}
+	t.first = first;
+	t.end = end;
+	t.start = now;
+	__atomic_store_n(&t.active, true, __ATOMIC_RELEASE);
+}
+
+// Segments changed, running transitions do not match them anymore
+void resetTransitions() {
+	for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++) {
+		__atomic_store_n(&transitions[i].active, false, __ATOMIC_RELEASE);
+	}
+}
+
+// Copy the frame and blend the outgoing frame into all segments in transition (size in bytes)
+void applyTransition(const uint8_t* pixels, uint8_t* out, size_t size) {
+	memcpy(out, pixels, size);
+	uint32_t now = millis();
+	for (uint8_t i = 0; i < MAX_NUM_SEGMENTS; i++) {
+		Transition& t = transitions[i];
+		if (!__atomic_load_n(&t.active, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		uint16_t weight = getTransitionWeight(t, now);
+		if (weight >= 256) {
+			// This frame shows the new animation only
+			__atomic_store_n(&t.active, false, __ATOMIC_RELEASE);
+			continue;
+		}
+		blendTransition(transitionFrom, pixels, out, t.first, min((size_t)t.end, size), weight);
+	}
+}
@@ -0,0 +1,165 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Adafruit_NeoPixel shim for the native environment
+ *
+ * WS2812FX renders into the pixel buffer of Adafruit_NeoPixel. This keeps the same buffer
+ * layout, brightness scaling and protected members, but show() only counts frames; the
+ * firmware sends them through customShow() and the RMT shim anyway.
+ */
+#ifndef ADAFRUIT_NEOPIXEL_H
+#define ADAFRUIT_NEOPIXEL_H
+
+#include <Arduino.h>
+
+typedef uint16_t neoPixelType;
+
+// Offsets of W, R, G and B in a pixel, 2 bits each
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_RBG ((0 << 6) | (0 << 4) | (2 << 2) | (1))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_GBR ((2 << 6) | (2 << 4) | (0 << 2) | (1))
+#define NEO_BRG ((1 << 6) | (1 << 4) | (2 << 2) | (0))
+#define NEO_BGR ((2 << 6) | (2 << 4) | (1 << 2) | (0))
+#define NEO_RGBW ((3 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRBW ((3 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel {
+public:
+	Adafruit_NeoPixel(uint16_t n, int16_t p = 6, neoPixelType t = NEO_GRB + NEO_KHZ800) : pin(p) {
+		updateType(t);
+		updateLength(n);
+	}
+	Adafruit_NeoPixel() : pin(-1) { updateType(NEO_GRB + NEO_KHZ800); }
+	virtual ~Adafruit_NeoPixel() { free(pixels); }
+
+	void begin() { begun = true; }
+	void show() { shows++; }
+	void setPin(int16_t p) { pin = p; }
+	bool canShow() { return true; }
+
+	void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+		if (n < numLEDs) {
+			scale(r, g, b);
+			uint8_t* p = pixels + n * (wOffset == rOffset ? 3 : 4);
+			p[rOffset] = r;
+			p[gOffset] = g;
+			p[bOffset] = b;
+		}
+	}
+	void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+		if (n < numLEDs) {
+			setPixelColor(n, r, g, b);
+			if (wOffset != rOffset) {
+				pixels[n * 4 + wOffset] = brightness ? (w * brightness) >> 8 : w;
+			}
+		}
+	}
+	void setPixelColor(uint16_t n, uint32_t c) {
+		setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c, (uint8_t)(c >> 24));
+	}
+	uint32_t getPixelColor(uint16_t n) const {
+		if (n >= numLEDs) {
+			return 0;
+		}
+		const uint8_t* p = pixels + n * (wOffset == rOffset ? 3 : 4);
+		uint32_t c = ((uint32_t)unscale(p[rOffset]) << 16) | ((uint32_t)unscale(p[gOffset]) << 8) | unscale(p[bOffset]);
+		return wOffset == rOffset ? c : c | ((uint32_t)unscale(p[wOffset]) << 24);
+	}
+	void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0) {
+		uint16_t end = count == 0 || first + count > numLEDs ? numLEDs : first + count;
+		for (uint16_t i = first; i < end; i++) {
+			setPixelColor(i, c);
+		}
+	}
+	void clear() { memset(pixels, 0, numBytes); }
+
+	// Stored as brightness + 1 like the library, 0 means full brightness and no scaling
+	void setBrightness(uint8_t b) {
+		uint8_t newBrightness = b + 1;
+		if (newBrightness != brightness) {
+			uint8_t oldBrightness = brightness - 1;
+			uint16_t scale = oldBrightness == 0 ? 0 : b == 255 ? 65535 / oldBrightness : (((uint16_t)newBrightness << 8) - 1) / oldBrightness;
+			for (uint16_t i = 0; i < numBytes; i++) {
+				pixels[i] = (pixels[i] * scale) >> 8;
+			}
+			brightness = newBrightness;
+		}
+	}
+	uint8_t getBrightness() const { return brightness - 1; }
+
+	void updateLength(uint16_t n) {
+		free(pixels);
+		numBytes = n * (wOffset == rOffset ? 3 : 4);
+		pixels = (uint8_t*)calloc(numBytes ? numBytes : 1, 1);
+		numLEDs = pixels ? n : 0;
+		if (!pixels) {
+			numBytes = 0;
+		}
+	}
+	void updateType(neoPixelType t) {
+		bool oldThreeBytesPerPixel = wOffset == rOffset;
+		wOffset = (t >> 6) & 3;
+		rOffset = (t >> 4) & 3;
+		gOffset = (t >> 2) & 3;
+		bOffset = t & 3;
+		is800KHz = !(t & NEO_KHZ400);
+		if (pixels && oldThreeBytesPerPixel != (wOffset == rOffset)) {
+			updateLength(numLEDs);
+		}
+	}
+
+	uint8_t* getPixels() const { return pixels; }
+	int16_t getPin() const { return pin; }
+	uint16_t numPixels() const { return numLEDs; }
+
+	static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+	static uint32_t Color(uint8_t r, uint8_t g, uint8_t b, uint8_t w) { return ((uint32_t)w << 24) | Color(r, g, b); }
+	static uint8_t sine8(uint8_t x) { return (uint8_t)(sinf(x * 2 * (float)M_PI / 256) * 127.5f + 128); }
+	static uint8_t gamma8(uint8_t x) { return (uint8_t)(powf(x / 255.0f, 2.6f) * 255 + 0.5f); }
+	static uint32_t gamma32(uint32_t c) {
+		return ((uint32_t)gamma8(c >> 24) << 24) | ((uint32_t)gamma8(c >> 16) << 16) | ((uint32_t)gamma8(c >> 8) << 8) | gamma8(c);
+	}
+
+	uint32_t shows = 0;					// Calls of show(), i.e. frames sent without customShow()
+
+protected:
+	bool is800KHz = true;
+	bool begun = false;
+	uint16_t numLEDs = 0;
+	uint16_t numBytes = 0;
+	int16_t pin;
+	uint8_t brightness = 0;
+	uint8_t* pixels = NULL;
+	uint8_t rOffset = 1;
+	uint8_t gOffset = 0;
+	uint8_t bOffset = 2;
+	uint8_t wOffset = 1;
+	uint32_t endTime = 0;
+
+private:
+	void scale(uint8_t& r, uint8_t& g, uint8_t& b) const {
+		if (brightness) {
+			r = (r * brightness) >> 8;
+			g = (g * brightness) >> 8;
+			b = (b * brightness) >> 8;
+		}
+	}
+	uint8_t unscale(uint8_t value) const {
+		return brightness ? ((uint16_t)value << 8) / brightness : value;
+	}
+};
+
+#endif
@@ -0,0 +1,350 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Arduino shim for the native environment
+ *
+ * Just enough of the Arduino core to compile the firmware headers on the host: a simulated
+ * clock that only moves when a test advances it (or code calls delay()), String, Print,
+ * Stream and a Serial that writes to stdout.
+ */
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+#include <algorithm>
+#include <functional>
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define F(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+class __FlashStringHelper;						// Flash strings are plain strings here, WS2812FX names its modes with it
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+
+#include "shim_heap.h"
+
+// newlib on the ESP32 has strlcpy(), glibc only since 2.38
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+	size_t length = strlen(src);
+	if (size > 0) {
+		size_t n = length < size - 1 ? length : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = 0;
+	}
+	return length;
+}
+#endif
+
+/**
+ * Simulated clock
+ */
+inline uint64_t& shimClock() {
+	static uint64_t now = 0;		// Microseconds since "boot"
+	return now;
+}
+
+inline void advanceClock(uint64_t us) { shimClock() += us; }
+inline unsigned long millis() { return (unsigned long)(shimClock() / 1000); }
+inline unsigned long micros() { return (unsigned long)shimClock(); }
+inline void delay(uint32_t ms) { advanceClock((uint64_t)ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { advanceClock(us); }
+inline void yield() {}
+
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall; }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) { return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin; }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+/**
+ * String, heap usage is counted by shim_heap.h
+ */
+class String {
+public:
+	String(const char* s = "") { assign(s ? s : "", s ? strlen(s) : 0); }
+	String(const String& s) { assign(s._buffer ? s._buffer : "", s._length); }
+	String(char c) { char s[2] = { c, 0 }; assign(s, 1); }
+	String(int value, unsigned char base = 10) { char s[34]; format(s, value, base); assign(s, strlen(s)); }
+	String(unsigned int value, unsigned char base = 10) { char s[34]; formatUnsigned(s, value, base); assign(s, strlen(s)); }
+	String(long value, unsigned char base = 10) { char s[34]; format(s, value, base); assign(s, strlen(s)); }
+	String(unsigned long value, unsigned char base = 10) { char s[34]; formatUnsigned(s, value, base); assign(s, strlen(s)); }
+	String(double value, unsigned char decimals = 2) { char s[34]; snprintf(s, sizeof(s), "%.*f", decimals, value); assign(s, strlen(s)); }
+	~String() { shimFree(_buffer); }
+
+	String& operator=(const String& s) {
+		if (this != &s) {
+			assign(s._buffer ? s._buffer : "", s._length);
+		}
+		return *this;
+	}
+	String& operator=(const char* s) { assign(s ? s : "", s ? strlen(s) : 0); return *this; }
+
+	unsigned int length() const { return _length; }
+	const char* c_str() const { return _buffer ? _buffer : ""; }
+	bool reserve(unsigned int size) { return grow(size); }
+
+	bool concat(const char* s, unsigned int length) {
+		if (!grow(_length + length)) {
+			return false;
+		}
+		memcpy(_buffer + _length, s, length);
+		_length += length;
+		_buffer[_length] = 0;
+		return true;
+	}
+	bool concat(const String& s) { return concat(s.c_str(), s._length); }
+	bool concat(const char* s) { return concat(s, strlen(s)); }
+	bool concat(char c) { return concat(&c, 1); }
+	bool concat(int value) { return concat(String(value)); }
+	bool concat(unsigned int value) { return concat(String(value)); }
+	bool concat(long value) { return concat(String(value)); }
+	bool concat(unsigned long value) { return concat(String(value)); }
+
+	template<typename T> String& operator+=(const T& value) { concat(value); return *this; }
+	template<typename T> friend String operator+(const String& a, const T& b) { String s(a); s.concat(b); return s; }
+	friend String operator+(const char* a, const String& b) { String s(a); s.concat(b); return s; }
+
+	bool equals(const String& s) const { return _length == s._length && strcmp(c_str(), s.c_str()) == 0; }
+	bool equals(const char* s) const { return strcmp(c_str(), s) == 0; }
+	bool equalsIgnoreCase(const String& s) const { return _length == s._length && strcasecmp(c_str(), s.c_str()) == 0; }
+	bool operator==(const String& s) const { return equals(s); }
+	bool operator==(const char* s) const { return equals(s); }
+	bool operator!=(const String& s) const { return !equals(s); }
+	bool operator!=(const char* s) const { return !equals(s); }
+	char operator[](unsigned int index) const { return index < _length ? _buffer[index] : 0; }
+	char charAt(unsigned int index) const { return (*this)[index]; }
+
+	bool startsWith(const String& s) const { return s._length <= _length && strncmp(c_str(), s.c_str(), s._length) == 0; }
+	bool endsWith(const String& s) const { return s._length <= _length && strcmp(c_str() + _length - s._length, s.c_str()) == 0; }
+	int indexOf(char c, unsigned int from = 0) const {
+		const char* p = from < _length ? strchr(c_str() + from, c) : NULL;
+		return p ? p - c_str() : -1;
+	}
+	int indexOf(const String& s, unsigned int from = 0) const {
+		const char* p = from <= _length ? strstr(c_str() + from, s.c_str()) : NULL;
+		return p ? p - c_str() : -1;
+	}
+	int lastIndexOf(char c) const {
+		const char* p = strrchr(c_str(), c);
+		return p ? p - c_str() : -1;
+	}
+	String substring(unsigned int from, unsigned int to) const {
+		to = min(to, _length);
+		from = min(from, to);
+		String s;
+		s.concat(c_str() + from, to - from);
+		return s;
+	}
+	String substring(unsigned int from) const { return substring(from, _length); }
+	long toInt() const { return atol(c_str()); }
+	void trim() {
+		unsigned int start = 0;
+		while (start < _length && isspace((unsigned char)_buffer[start])) {
+			start++;
+		}
+		unsigned int end = _length;
+		while (end > start && isspace((unsigned char)_buffer[end - 1])) {
+			end--;
+		}
+		if (_buffer) {
+			memmove(_buffer, _buffer + start, end - start);
+			_length = end - start;
+			_buffer[_length] = 0;
+		}
+	}
+
+private:
+	char* _buffer = NULL;
+	unsigned int _capacity = 0;
+	unsigned int _length = 0;
+
+	bool grow(unsigned int size) {
+		if (_buffer && size <= _capacity) {
+			return true;
+		}
+		char* buffer = (char*)shimRealloc(_buffer, size + 1);
+		if (buffer == NULL) {
+			return false;
+		}
+		if (_buffer == NULL) {
+			buffer[0] = 0;
+		}
+		_buffer = buffer;
+		_capacity = size;
+		return true;
+	}
+	void assign(const char* s, unsigned int length) {
+		_length = 0;
+		if (grow(length)) {
+			memmove(_buffer, s, length);
+			_length = length;
+			_buffer[_length] = 0;
+		}
+	}
+	static void format(char* s, long value, unsigned char base) {
+		if (base == 10) {
+			sprintf(s, "%ld", value);
+		} else {
+			formatUnsigned(s, (unsigned long)value, base);
+		}
+	}
+	static void formatUnsigned(char* s, unsigned long value, unsigned char base) {
+		char digits[34];
+		int n = 0;
+		do {
+			digits[n++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+			value /= base;
+		} while (value > 0);
+		while (n > 0) {
+			*s++ = digits[--n];
+		}
+		*s = 0;
+	}
+};
+
+// Result type of String concatenation in the Arduino core, ArduinoJson accepts it as a string
+class StringSumHelper : public String {
+public:
+	StringSumHelper(const String& s) : String(s) {}
+	StringSumHelper(const char* s) : String(s) {}
+};
+
+/**
+ * Print and Stream
+ */
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size) {
+		size_t n = 0;
+		while (size--) {
+			n += write(*buffer++);
+		}
+		return n;
+	}
+	size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+	size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+	size_t print(const char* s) { return write(s); }
+	size_t print(const String& s) { return write(s.c_str(), s.length()); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(int value) { return print(String(value)); }
+	size_t print(unsigned int value) { return print(String(value)); }
+	size_t print(long value) { return print(String(value)); }
+	size_t print(unsigned long value) { return print(String(value)); }
+	size_t println() { return write("\r\n"); }
+	template<typename T> size_t println(const T& value) { return print(value) + println(); }
+
+	size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char line[256];
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		return length > 0 ? write(line, min((size_t)length, sizeof(line) - 1)) : 0;
+	}
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() {}
+
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	unsigned long getTimeout() const { return _timeout; }
+
+	virtual size_t readBytes(char* buffer, size_t length) {
+		size_t count = 0;
+		while (count < length) {
+			int c = timedRead();
+			if (c < 0) {
+				break;
+			}
+			*buffer++ = (char)c;
+			count++;
+		}
+		return count;
+	}
+	size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+	size_t readBytesUntil(char terminator, char* buffer, size_t length) {
+		size_t index = 0;
+		while (index < length) {
+			int c = timedRead();
+			if (c < 0 || c == terminator) {
+				break;
+			}
+			*buffer++ = (char)c;
+			index++;
+		}
+		return index;
+	}
+
+protected:
+	unsigned long _timeout = 1000;
+
+	// Waits on the simulated clock, so a missing byte costs no real time
+	int timedRead() {
+		unsigned long start = millis();
+		do {
+			int c = read();
+			if (c >= 0) {
+				return c;
+			}
+			delay(1);
+		} while (millis() - start < _timeout);
+		return -1;
+	}
+};
+
+class HardwareSerial : public Stream {
+public:
+	void begin(unsigned long) {}
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+	size_t write(uint8_t c) { return quiet ? 1 : fwrite(&c, 1, 1, stdout); }
+	size_t write(const uint8_t* buffer, size_t size) { return quiet ? size : fwrite(buffer, 1, size, stdout); }
+	using Print::write;
+
+	bool quiet = true;			// Firmware output is dropped unless a test wants to see it
+};
+
+static HardwareSerial Serial;
+
+#endif
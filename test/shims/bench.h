@@ -0,0 +1,49 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Host benchmarks for the native environment
+ *
+ * millis() and micros() run on the simulated clock, benchmarks measure real time instead.
+ * Every measurement is repeated and the fastest run is kept, so other processes on the host
+ * do not count. Results are printed, run with "pio test -e native -v" to see them.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 5
+#endif
+
+// Results are written here, so the compiler cannot drop the work that is measured
+volatile uint32_t benchSink = 0;
+
+// Fastest time of one call of fn (ns), over BENCH_RUNS runs of the given iterations
+template<typename F> double benchmarkNs(uint32_t iterations, F fn) {
+	double best = 0;
+	for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < iterations; i++) {
+			fn();
+		}
+		std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+		double perCall = time.count() / iterations;
+		best = run == 0 || perCall < best ? perCall : best;
+	}
+	return best;
+}
+
+#endif
@@ -0,0 +1,227 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * RMT driver shim for the native environment
+ *
+ * Emulates the ESP-IDF RMT Tx driver closely enough to run ESP32_RMT_Driver.h on the host:
+ * rmt_write_sample() feeds the installed translator in the same portions as the driver
+ * (the whole channel memory first, then half of it per refill interrupt), checks that it
+ * never writes more items than asked for, decodes the WS2812 pulses back into bytes and
+ * hands every frame to a sink. Sending takes simulated time, 1.25 us per bit.
+ */
+#ifndef RMT_SHIM_H
+#define RMT_SHIM_H
+
+#include <Arduino.h>
+#include <vector>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+
+typedef uint32_t TickType_t;
+#define portMAX_DELAY 0xFFFFFFFF
+
+typedef int gpio_num_t;
+
+typedef enum {
+	RMT_CHANNEL_0, RMT_CHANNEL_1, RMT_CHANNEL_2, RMT_CHANNEL_3,
+	RMT_CHANNEL_4, RMT_CHANNEL_5, RMT_CHANNEL_6, RMT_CHANNEL_7,
+	RMT_CHANNEL_MAX
+} rmt_channel_t;
+
+typedef enum { RMT_MODE_TX, RMT_MODE_RX } rmt_mode_t;
+typedef enum { RMT_IDLE_LEVEL_LOW, RMT_IDLE_LEVEL_HIGH } rmt_idle_level_t;
+
+typedef struct {
+	union {
+		struct {
+			uint32_t duration0 : 15;
+			uint32_t level0 : 1;
+			uint32_t duration1 : 15;
+			uint32_t level1 : 1;
+		};
+		uint32_t val;
+	};
+} rmt_item32_t;
+
+typedef struct {
+	uint8_t loop_en;
+	uint8_t carrier_en;
+	uint8_t idle_output_en;
+	rmt_idle_level_t idle_level;
+} rmt_tx_config_t;
+
+typedef struct {
+	rmt_mode_t rmt_mode;
+	rmt_channel_t channel;
+	gpio_num_t gpio_num;
+	uint8_t clk_div;
+	uint8_t mem_block_num;
+	rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+typedef void (*sample_to_rmt_t)(const void* src, rmt_item32_t* dest, size_t src_size, size_t wanted_num, size_t* translated_size, size_t* item_num);
+
+#define RMT_MEM_ITEM_NUM 64						// Items per memory block
+#define RMT_SHIM_APB_MHZ 80
+#define RMT_SHIM_BIT_TIME 1250					// WS2812 bit time (ns)
+#define RMT_SHIM_BIT_THRESHOLD 600				// High time (ns) above which a pulse is a 1
+
+// Receives every decoded frame, data excludes the reset pulse
+typedef void (*RmtShimSink)(rmt_channel_t channel, const uint8_t* data, size_t length);
+
+struct RmtShimChannel {
+	bool configured;
+	bool installed;
+	gpio_num_t gpio;
+	uint8_t clkDiv;
+	uint8_t memBlocks;
+	sample_to_rmt_t translator;
+	uint64_t busyUntil;						// Simulated time the current frame is sent
+	uint32_t frames;
+	uint32_t items;							// Items of the last frame
+	bool overflow;							// Translator wrote more items than asked for
+	bool resetMissing;						// Last frame did not end with a reset pulse
+	std::vector<uint8_t> data;				// Last frame, decoded
+};
+
+struct RmtShim {
+	RmtShimChannel channels[RMT_CHANNEL_MAX];
+	RmtShimSink sink;
+};
+
+inline RmtShim& rmtShim() {
+	static RmtShim shim;
+	return shim;
+}
+
+inline void resetRmtShim() {
+	RmtShim& shim = rmtShim();
+	for (RmtShimChannel& channel : shim.channels) {
+		channel = RmtShimChannel();
+	}
+	shim.sink = NULL;
+}
+
+inline esp_err_t rmt_config(const rmt_config_t* config) {
+	if (config == NULL || config->channel >= RMT_CHANNEL_MAX || config->mem_block_num == 0 || config->channel + config->mem_block_num > RMT_CHANNEL_MAX) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	// A channel with several memory blocks uses the blocks of the following channels
+	for (int i = 0; i < RMT_CHANNEL_MAX; i++) {
+		const RmtShimChannel& other = rmtShim().channels[i];
+		if (i != config->channel && other.configured && config->channel < i + other.memBlocks && i < config->channel + config->mem_block_num) {
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+	RmtShimChannel& channel = rmtShim().channels[config->channel];
+	channel.configured = true;
+	channel.gpio = config->gpio_num;
+	channel.clkDiv = config->clk_div;
+	channel.memBlocks = config->mem_block_num;
+	return ESP_OK;
+}
+
+inline esp_err_t rmt_driver_install(rmt_channel_t channel, size_t, int) {
+	if (channel >= RMT_CHANNEL_MAX || !rmtShim().channels[channel].configured) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	rmtShim().channels[channel].installed = true;
+	return ESP_OK;
+}
+
+inline esp_err_t rmt_translator_init(rmt_channel_t channel, sample_to_rmt_t translator) {
+	if (channel >= RMT_CHANNEL_MAX || !rmtShim().channels[channel].installed) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	rmtShim().channels[channel].translator = translator;
+	return ESP_OK;
+}
+
+inline esp_err_t rmt_wait_tx_done(rmt_channel_t channel, TickType_t) {
+	if (channel >= RMT_CHANNEL_MAX) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	uint64_t busyUntil = rmtShim().channels[channel].busyUntil;
+	if (busyUntil > shimClock()) {
+		shimClock() = busyUntil;
+	}
+	return ESP_OK;
+}
+
+// Decode WS2812 pulses into bytes, stops at the reset pulse
+inline void rmtShimDecode(RmtShimChannel& channel, const std::vector<rmt_item32_t>& items) {
+	uint32_t tickNs = channel.clkDiv * 1000 / RMT_SHIM_APB_MHZ;
+	channel.data.clear();
+	channel.resetMissing = true;
+	uint8_t value = 0;
+	uint8_t bits = 0;
+	for (const rmt_item32_t& item : items) {
+		if (item.level0 == 0) {
+			channel.resetMissing = false;
+			break;
+		}
+		value = (value << 1) | (item.duration0 * tickNs > RMT_SHIM_BIT_THRESHOLD ? 1 : 0);
+		if (++bits == 8) {
+			channel.data.push_back(value);
+			bits = 0;
+		}
+	}
+}
+
+inline esp_err_t rmt_write_sample(rmt_channel_t channel, const uint8_t* src, size_t src_size, bool wait_tx_done) {
+	if (channel >= RMT_CHANNEL_MAX || rmtShim().channels[channel].translator == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	RmtShimChannel& c = rmtShim().channels[channel];
+	// The driver waits until the previous frame of this channel was sent
+	rmt_wait_tx_done(channel, portMAX_DELAY);
+
+	std::vector<rmt_item32_t> items;
+	size_t offset = 0;
+	size_t wanted = c.memBlocks * RMT_MEM_ITEM_NUM;
+	c.overflow = false;
+	while (offset < src_size) {
+		// One spare item more than asked for, written only by a translator that overshoots
+		std::vector<rmt_item32_t> portion(wanted + 8);
+		size_t translated = 0;
+		size_t num = 0;
+		c.translator(src + offset, portion.data(), src_size - offset, wanted, &translated, &num);
+		if (num > wanted) {
+			c.overflow = true;
+		}
+		if (translated == 0) {
+			break;
+		}
+		items.insert(items.end(), portion.begin(), portion.begin() + num);
+		offset += translated;
+		wanted = c.memBlocks * RMT_MEM_ITEM_NUM / 2;		// Refill interrupts fill half of the memory
+	}
+
+	c.items = items.size();
+	c.frames++;
+	rmtShimDecode(c, items);
+	c.busyUntil = shimClock() + (uint64_t)c.items * RMT_SHIM_BIT_TIME / 1000;
+	if (rmtShim().sink) {
+		rmtShim().sink(channel, c.data.data(), c.data.size());
+	}
+	if (wait_tx_done) {
+		rmt_wait_tx_done(channel, portMAX_DELAY);
+	}
+	return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * LED strip emulator for the native environment
+ *
+ * Runs WS2812FX with the firmware's output path: customShow() hands every frame to
+ * sendFrame(), which captures it into the frame ring and sends it through crossfade, colour
+ * pipeline and RMT translator to the RMT driver shim. The shim decodes the pulses back into
+ * the pixels the strip would show. The ring can be dumped as PPM or ANSI frames. Real time
+ * spent in customShow() is counted, so the render time of service() can be told apart; the
+ * tick WS2812FX yields before each frame only advances the simulated clock.
+ */
+#ifndef LED_EMULATOR_H
+#define LED_EMULATOR_H
+
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+#include <WS2812FX.h>
+#include "ESP32_RMT_Driver.h"
+#include "page_writer.h"
+#include "metrics.h"
+#include "color_pipeline.h"
+#include "transition.h"
+#include "frame_capture.h"
+#include "led_output.h"
+
+struct LedEmulator {
+	WS2812FX* strip;
+	std::vector<uint8_t> memory;	// Memory of the frame ring
+	std::vector<uint8_t> shown;		// Frame decoded from the RMT pulses (GRB), what the strip shows
+	uint32_t shows;					// Calls of customShow()
+	double showNs;					// Real time spent in customShow()
+};
+
+LedEmulator emulator;
+FILE* emulatorDumpFile = NULL;
+
+// The parts of a frame split across channels arrive in channel order
+void emulatorSink(rmt_channel_t channel, const uint8_t* data, size_t length) {
+	if (channel == tx_channels[0]) {
+		emulator.shown.clear();
+	}
+	emulator.shown.insert(emulator.shown.end(), data, data + length);
+}
+
+// customShow() of the firmware
+void emulatorShow() {
+	auto start = std::chrono::steady_clock::now();
+	sendFrame(*emulator.strip, false);
+	std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+	emulator.showNs += time.count();
+	emulator.shows++;
+}
+
+// Make room for the given number of frames of the current strip length, drops all frames and statistics
+void resizeEmulator(uint32_t frames) {
+	size_t frameBytes = emulator.strip->getNumBytes();
+	// The ring leaves out its oldest slot when read
+	emulator.memory.assign((frames + 1) * ((sizeof(CapturedFrame) + frameBytes + 3) & ~(size_t)3), 0);
+	initFrameRing(frameCapture, emulator.memory.data(), emulator.memory.size(), frameBytes);
+	emulator.shown.clear();
+	emulator.shows = 0;
+	emulator.showNs = 0;
+}
+
+// Attach the emulator to a strip, it keeps the last frames rendered
+void beginEmulator(WS2812FX& strip, uint32_t frames, const char* rmtPins = "") {
+	emulator.strip = &strip;
+	resetRmtShim();
+	rmt_tx_init_pins(rmtPins, strip.getPin());
+	tx_last_size = 0;				// Send the first frame even if the last test ended with the same one
+	rmtShim().sink = emulatorSink;
+	strip.setCustomShow(emulatorShow);
+	resizeEmulator(frames);
+}
+
+void emulatorDumpChunk(const char* data, size_t length) {
+	fwrite(data, 1, length, emulatorDumpFile);
+}
+
+// Write the captured frames as PPM image or as ANSI terminal colours
+void dumpFrames(FILE* file, bool ansi) {
+	emulatorDumpFile = file;
+	PageWriter out(emulatorDumpChunk);
+	if (ansi) {
+		writeFramesAnsi(out, frameCapture);
+	} else {
+		writeFramesPpm(out, frameCapture);
+	}
+	out.flush();
+}
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Stream over a buffer for the native environment
+ *
+ * Stands in for a network client. available() reports at most packetSize bytes, like data
+ * arriving in packets, and reading past the end waits on the simulated clock like a
+ * connection that stays open.
+ */
+#ifndef MEMORY_STREAM_H
+#define MEMORY_STREAM_H
+
+#include <Arduino.h>
+
+class MemoryStream : public Stream {
+public:
+	MemoryStream(const char* data, size_t length = 0, size_t packetSize = 0)
+		: _data(data), _length(length ? length : strlen(data)), _packetSize(packetSize) {}
+
+	int available() {
+		size_t left = _length - _position;
+		return _packetSize > 0 && left > _packetSize ? _packetSize : left;
+	}
+	int read() { return _position < _length ? (uint8_t)_data[_position++] : -1; }
+	int peek() { return _position < _length ? (uint8_t)_data[_position] : -1; }
+	size_t write(uint8_t) { return 0; }
+	using Print::write;
+
+	size_t position() const { return _position; }
+	size_t left() const { return _length - _position; }
+
+private:
+	const char* _data;
+	size_t _length;
+	size_t _packetSize;
+	size_t _position = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Heap accounting for the native environment
+ *
+ * String and the counting JSON allocator allocate through these functions, so tests can
+ * compare allocations and peak heap of two code paths.
+ */
+#ifndef SHIM_HEAP_H
+#define SHIM_HEAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct ShimHeapStats {
+	uint32_t allocations;		// Number of malloc/realloc calls
+	size_t allocated;			// Bytes requested in total
+	size_t current;				// Bytes in use
+	size_t peak;				// Max. bytes in use since the last reset
+};
+
+inline ShimHeapStats& shimHeap() {
+	static ShimHeapStats stats;
+	return stats;
+}
+
+// Start a new measurement, memory still in use stays counted
+inline void resetHeapStats() {
+	ShimHeapStats& stats = shimHeap();
+	stats.allocations = 0;
+	stats.allocated = 0;
+	stats.peak = stats.current;
+}
+
+// Every block starts with its size, so free() can account for it
+struct ShimBlock {
+	size_t size;
+	size_t padding;
+};
+
+inline void* shimRealloc(void* ptr, size_t size) {
+	ShimBlock* block = ptr ? (ShimBlock*)ptr - 1 : NULL;
+	ShimBlock* resized = (ShimBlock*)realloc(block, sizeof(ShimBlock) + size);
+	if (resized == NULL) {
+		return NULL;
+	}
+	ShimHeapStats& stats = shimHeap();
+	stats.allocations++;
+	stats.allocated += size;
+	stats.current += size - (block ? resized->size : 0);
+	stats.peak = stats.current > stats.peak ? stats.current : stats.peak;
+	resized->size = size;
+	return resized + 1;
+}
+
+inline void* shimMalloc(size_t size) {
+	return shimRealloc(NULL, size);
+}
+
+inline void shimFree(void* ptr) {
+	if (ptr) {
+		ShimBlock* block = (ShimBlock*)ptr - 1;
+		shimHeap().current -= block->size;
+		free(block);
+	}
+}
+
+// ESP-IDF heap capabilities, the host has no limit worth reporting
+#define MALLOC_CAP_8BIT (1 << 2)
+inline uint32_t heap_caps_get_largest_free_block(uint32_t) { return UINT32_MAX; }
+
+#endif
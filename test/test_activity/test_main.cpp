@@ -0,0 +1,59 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Presence activities
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "activity.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_all_names() {
+	for (uint8_t i = 0; i < ACTIVITY_COUNT; i++) {
+		TEST_ASSERT_EQUAL(i, getActivity(activityNames[i]));
+	}
+}
+
+void test_unknown_names() {
+	TEST_ASSERT_EQUAL(ACTIVITY_UNKNOWN, getActivity(""));
+	TEST_ASSERT_EQUAL(ACTIVITY_UNKNOWN, getActivity("busy"));
+	TEST_ASSERT_EQUAL(ACTIVITY_UNKNOWN, getActivity("Busy "));
+	TEST_ASSERT_EQUAL(ACTIVITY_UNKNOWN, getActivity("InAMeetings"));
+}
+
+void test_hash_is_fnv1a() {
+	TEST_ASSERT_EQUAL_HEX32(0x811C9DC5, activityHash(""));
+	TEST_ASSERT_EQUAL_HEX32(0xE40C292C, activityHash("a"));
+	static_assert(activityHash("Busy") != activityHash("Away"), "evaluated at compile time");
+}
+
+void test_offline() {
+	TEST_ASSERT_TRUE(isOfflineActivity(ACTIVITY_OFFLINE));
+	TEST_ASSERT_TRUE(isOfflineActivity(ACTIVITY_OFFWORK));
+	TEST_ASSERT_TRUE(isOfflineActivity(ACTIVITY_OUTOFOFFICE));
+	TEST_ASSERT_TRUE(isOfflineActivity(ACTIVITY_PRESENCEUNKNOWN));
+	TEST_ASSERT_FALSE(isOfflineActivity(ACTIVITY_AWAY));
+	TEST_ASSERT_FALSE(isOfflineActivity(ACTIVITY_INACTIVE));
+	TEST_ASSERT_FALSE(isOfflineActivity(ACTIVITY_UNKNOWN));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_all_names);
+	RUN_TEST(test_unknown_names);
+	RUN_TEST(test_hash_is_fnv1a);
+	RUN_TEST(test_offline);
+	return UNITY_END();
+}
@@ -0,0 +1,146 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * HTTP response body stream
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "memory_stream.h"
+#include "body_stream.h"
+
+char body[64];
+
+void setUp() {
+	memset(body, 0, sizeof(body));
+}
+
+void tearDown() {}
+
+void test_content_length() {
+	MemoryStream connection("{\"a\":1}HTTP/1.1 200 OK");
+	BodyStream stream(connection, 7, false);
+	TEST_ASSERT_EQUAL(7, stream.available());
+	TEST_ASSERT_EQUAL(7, stream.readBody(body, sizeof(body)));
+	TEST_ASSERT_EQUAL_STRING("{\"a\":1}", body);
+	TEST_ASSERT_TRUE(stream.complete());
+	TEST_ASSERT_EQUAL(-1, stream.read());
+	// The next response is left untouched
+	TEST_ASSERT_EQUAL('H', connection.peek());
+}
+
+void test_empty_body() {
+	MemoryStream connection("");
+	BodyStream stream(connection, 0, false);
+	TEST_ASSERT_TRUE(stream.complete());
+	TEST_ASSERT_TRUE(stream.drain(0));
+}
+
+void test_chunked() {
+	MemoryStream connection("4\r\n{\"a\"\r\n3;ext\r\n:1}\r\n0\r\n\r\nNEXT", 0, 5);
+	BodyStream stream(connection, BODY_LENGTH_UNKNOWN, true);
+	TEST_ASSERT_EQUAL(7, stream.readBody(body, sizeof(body)));
+	TEST_ASSERT_EQUAL_STRING("{\"a\":1}", body);
+	TEST_ASSERT_TRUE(stream.complete());
+	TEST_ASSERT_EQUAL('N', connection.peek());
+}
+
+void test_chunked_trailer() {
+	MemoryStream connection("2\r\nok\r\n0\r\nX-Trailer: 1\r\n\r\n");
+	BodyStream stream(connection, BODY_LENGTH_UNKNOWN, true);
+	TEST_ASSERT_TRUE(stream.drain(16));
+	TEST_ASSERT_EQUAL(0, connection.left());
+}
+
+// A parser that stops early leaves the terminating chunk, drain() reads it
+void test_drain_after_parser() {
+	MemoryStream connection("7\r\n{\"a\":1}\r\n0\r\n\r\n");
+	BodyStream stream(connection, BODY_LENGTH_UNKNOWN, true);
+	TEST_ASSERT_EQUAL(7, stream.readBytes(body, 7));
+	TEST_ASSERT_FALSE(stream.complete());
+	TEST_ASSERT_TRUE(stream.drain(16));
+}
+
+// Too much left over, the connection has to be closed
+void test_drain_limit() {
+	MemoryStream connection("0123456789");
+	BodyStream stream(connection, 10, false);
+	TEST_ASSERT_FALSE(stream.drain(4));
+	TEST_ASSERT_TRUE(stream.drain(6));
+}
+
+void test_broken_chunk() {
+	const char* broken[] = { "4\r\nabcdX\r\n0\r\n\r\n", "zz\r\n", "4\nabcd\r\n0\r\n\r\n", "4\r\nab" };
+	for (const char* data : broken) {
+		MemoryStream connection(data);
+		connection.setTimeout(10);
+		BodyStream stream(connection, BODY_LENGTH_UNKNOWN, true);
+		stream.setTimeout(10);
+		stream.readBody(body, sizeof(body));
+		TEST_ASSERT_FALSE(stream.complete());
+	}
+}
+
+// Without length or chunks the body ends with the connection, it can never be reused
+void test_unknown_length() {
+	MemoryStream connection("abc");
+	BodyStream stream(connection, BODY_LENGTH_UNKNOWN, false);
+	stream.setTimeout(10);
+	TEST_ASSERT_EQUAL(3, stream.readBody(body, sizeof(body)));
+	TEST_ASSERT_FALSE(stream.drain(16));
+}
+
+// Missing bytes wait for the timeout, the end of the body does not
+void test_timeout() {
+	MemoryStream connection("abc");
+	connection.setTimeout(50);
+	BodyStream stream(connection, 3, false);
+	stream.setTimeout(50);
+	unsigned long start = millis();
+	TEST_ASSERT_EQUAL(3, stream.readBody(body, sizeof(body)));
+	TEST_ASSERT_EQUAL(start, millis());
+
+	MemoryStream shortConnection("ab");
+	BodyStream shortStream(shortConnection, 3, false);
+	shortStream.setTimeout(50);
+	TEST_ASSERT_EQUAL(2, shortStream.readBody(body, sizeof(body)));
+	TEST_ASSERT_EQUAL(start + 50, millis());
+	TEST_ASSERT_FALSE(shortStream.complete());
+}
+
+// A slow server gets the API read timeout, not the 1 s default of Stream
+void test_default_timeout() {
+	MemoryStream connection("ab");
+	BodyStream stream(connection, 3, false);
+	TEST_ASSERT_EQUAL(BODY_TIMEOUT, stream.getTimeout());
+	unsigned long start = millis();
+	TEST_ASSERT_EQUAL(2, stream.readBody(body, sizeof(body)));
+	TEST_ASSERT_EQUAL(start + BODY_TIMEOUT, millis());
+
+	BodyStream shortTimeout(connection, 3, false, 500);
+	TEST_ASSERT_EQUAL(500, shortTimeout.getTimeout());
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_content_length);
+	RUN_TEST(test_empty_body);
+	RUN_TEST(test_chunked);
+	RUN_TEST(test_chunked_trailer);
+	RUN_TEST(test_drain_after_parser);
+	RUN_TEST(test_drain_limit);
+	RUN_TEST(test_broken_chunk);
+	RUN_TEST(test_unknown_length);
+	RUN_TEST(test_timeout);
+	RUN_TEST(test_default_timeout);
+	return UNITY_END();
+}
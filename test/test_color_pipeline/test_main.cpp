@@ -0,0 +1,186 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Colour pipeline
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "bench.h"
+#include "color_pipeline.h"
+#define MAX_NUM_SEGMENTS 10			// As in WS2812FX
+#include "transition.h"
+
+#define BENCH_LEDS 500
+#define BENCH_FPS 100
+#define BENCH_ITERATIONS 2000
+
+void setUp() {
+	buildColorLut(100, COLOR_TEMPERATURE_NEUTRAL);
+	colorFrame = 0;
+}
+
+void tearDown() {}
+
+void test_full_range() {
+	const uint8_t pixels[6] = { 0, 255, 128, 255, 0, 1 };
+	uint8_t out[6];
+	applyColorPipeline(pixels, out, sizeof(out));
+	TEST_ASSERT_EQUAL(0, out[0]);
+	TEST_ASSERT_EQUAL(255, out[1]);
+	TEST_ASSERT_EQUAL(255, out[3]);
+	TEST_ASSERT_EQUAL(0, out[5]);
+	// Gamma 2.2, 128 is about a fifth of full power
+	TEST_ASSERT_UINT_WITHIN(1, 56, out[2]);
+}
+
+void test_brightness() {
+	buildColorLut(20, COLOR_TEMPERATURE_NEUTRAL);
+	const uint8_t pixels[3] = { 255, 255, 255 };
+	uint8_t out[3];
+	applyColorPipeline(pixels, out, sizeof(out));
+	TEST_ASSERT_EQUAL(51, out[0]);
+	TEST_ASSERT_EQUAL(51, out[1]);
+	TEST_ASSERT_EQUAL(51, out[2]);
+
+	buildColorLut(0, COLOR_TEMPERATURE_NEUTRAL);
+	applyColorPipeline(pixels, out, sizeof(out));
+	TEST_ASSERT_EQUAL(0, out[0] | out[1] | out[2]);
+}
+
+// Warm white keeps red at full power and cuts blue, buffer order is GRB
+void test_color_temperature() {
+	buildColorLut(100, 2700);
+	const uint8_t pixels[3] = { 255, 255, 255 };
+	uint8_t out[3];
+	applyColorPipeline(pixels, out, sizeof(out));
+	TEST_ASSERT_EQUAL(255, out[1]);
+	TEST_ASSERT_LESS_THAN(out[1], out[0]);
+	TEST_ASSERT_LESS_THAN(out[0], out[2]);
+}
+
+void test_in_place() {
+	uint8_t pixels[6] = { 255, 0, 255, 0, 255, 0 };
+	applyColorPipeline(pixels, pixels, sizeof(pixels));
+	const uint8_t expected[6] = { 255, 0, 255, 0, 255, 0 };
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, pixels, 6);
+}
+
+// A pending table is sent once, a frame without fractions needs no repeats
+void test_refresh() {
+	TEST_ASSERT_TRUE(colorNeedsRefresh());
+	const uint8_t pixels[3] = { 255, 0, 255 };
+	uint8_t out[3];
+	applyColorPipeline(pixels, out, sizeof(out));
+	TEST_ASSERT_FALSE(colorNeedsRefresh());
+}
+
+// Over 8 frames the average output matches the fixed point value
+void test_dithering() {
+	buildColorLut(20, COLOR_TEMPERATURE_NEUTRAL);
+	const uint8_t pixels[6] = { 128, 128, 128, 128, 128, 128 };
+	uint8_t out[6];
+	uint32_t sum = 0;
+	bool steps = false;
+	for (uint8_t frame = 0; frame < 8; frame++) {
+		applyColorPipeline(pixels, out, sizeof(out));
+		sum += out[0];
+		steps |= out[0] != out[3];
+	}
+	uint32_t expected = (colorLut[0][128] * 8 + 128) >> 8;
+#if COLOR_DITHERING
+	TEST_ASSERT_UINT_WITHIN(1, expected, sum);
+	TEST_ASSERT_TRUE(steps);			// Neighbouring pixels use different thresholds
+	TEST_ASSERT_TRUE(colorNeedsRefresh());
+#else
+	TEST_ASSERT_UINT_WITHIN(4, expected, sum);
+	TEST_ASSERT_FALSE(colorNeedsRefresh());
+#endif
+}
+
+// An unchanged frame is rounded after COLOR_DITHER_REPEATS repeats, so the LED task can sleep
+void test_static_frame_rounded() {
+	buildColorLut(20, COLOR_TEMPERATURE_NEUTRAL);
+	const uint8_t pixels[6] = { 128, 128, 128, 128, 128, 128 };
+	uint8_t out[6];
+	applyColorPipeline(pixels, out, sizeof(out));
+	for (uint16_t i = 0; i < COLOR_DITHER_REPEATS; i++) {
+		applyColorPipeline(pixels, out, sizeof(out), true);
+		TEST_ASSERT_EQUAL(COLOR_DITHERING, colorNeedsRefresh());
+	}
+	applyColorPipeline(pixels, out, sizeof(out), true);
+	TEST_ASSERT_FALSE(colorNeedsRefresh());
+	uint8_t rounded = (colorLut[0][128] + 128) >> 8;
+	TEST_ASSERT_EQUAL(rounded, out[0]);
+	TEST_ASSERT_EQUAL(rounded, out[3]);
+
+	// New tables start dithering again
+	buildColorLut(30, COLOR_TEMPERATURE_NEUTRAL);
+	applyColorPipeline(pixels, out, sizeof(out), true);
+	TEST_ASSERT_EQUAL(COLOR_DITHERING, colorNeedsRefresh());
+}
+
+void test_black_body() {
+	float rgb[3];
+	colorTemperatureToRgb(6500, rgb);
+	TEST_ASSERT_TRUE(rgb[0] > 250 && rgb[1] > 240 && rgb[2] > 240);
+	colorTemperatureToRgb(1900, rgb);
+	TEST_ASSERT_TRUE(rgb[0] == 255 && rgb[2] == 0);
+}
+
+uint8_t benchPixels[BENCH_LEDS * 3];
+uint8_t benchBlended[BENCH_LEDS * 3];
+uint8_t benchOut[BENCH_LEDS * 3];
+
+// Post-processing of one frame as in sendFrame(), at 500 LEDs it has to keep up with 100 fps with
+// a lot of room for rendering and sending. Printed as time per frame and share of the frame budget.
+void test_benchmark() {
+	for (size_t i = 0; i < sizeof(benchPixels); i++) {
+		benchPixels[i] = random(256);
+	}
+	buildColorLut(20, 3000);
+	double pipeline = benchmarkNs(BENCH_ITERATIONS, []() {
+		applyColorPipeline(benchPixels, benchOut, sizeof(benchOut));
+		benchSink += benchOut[benchSink % sizeof(benchOut)];
+	});
+
+	// Crossfade of the whole strip halfway through
+	resetTransitions();
+	startTransition(0, 0, BENCH_LEDS - 1, benchOut);
+	advanceClock(LED_TRANSITION_TIME / 2 * 1000);
+	double crossfade = benchmarkNs(BENCH_ITERATIONS, []() {
+		applyTransition(benchPixels, benchBlended, sizeof(benchBlended));
+		applyColorPipeline(benchBlended, benchOut, sizeof(benchOut));
+		benchSink += benchOut[benchSink % sizeof(benchOut)];
+	});
+	TEST_ASSERT_TRUE(transitionActive());
+
+	double budget = 1e9 / BENCH_FPS;
+	printf("colour pipeline, %d LEDs: %.1f us/frame (%.2f%% of the frame budget at %d fps), with crossfade %.1f us/frame (%.2f%%)\n",
+		BENCH_LEDS, pipeline / 1000, pipeline * 100 / budget, BENCH_FPS, crossfade / 1000, crossfade * 100 / budget);
+	// The ESP32 is far slower than the host, the host needs to stay below a hundredth of the budget
+	TEST_ASSERT_LESS_THAN(budget / 100, crossfade);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_full_range);
+	RUN_TEST(test_brightness);
+	RUN_TEST(test_color_temperature);
+	RUN_TEST(test_in_place);
+	RUN_TEST(test_refresh);
+	RUN_TEST(test_dithering);
+	RUN_TEST(test_static_frame_rounded);
+	RUN_TEST(test_black_body);
+	RUN_TEST(test_benchmark);
+	return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Streaming JSON field reader
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "memory_stream.h"
+#include "json_stream.h"
+
+char availability[16];
+char activity[32];
+JsonStreamField fields[2];
+
+void setUp() {
+	fields[0] = { "availability", availability, sizeof(availability) };
+	fields[1] = { "activity", activity, sizeof(activity) };
+}
+
+void tearDown() {}
+
+void test_presence() {
+	MemoryStream stream("{\"@odata.context\":\"https://graph.microsoft.com/v1.0/$metadata#users('x')/presence/$entity\","
+		"\"id\":\"fa8bf3dc-eca7-46b7-bad1-db199b62afc3\",\"availability\":\"Busy\",\"activity\":\"InAMeeting\"}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_TRUE(fields[0].found);
+	TEST_ASSERT_EQUAL_STRING("Busy", availability);
+	TEST_ASSERT_EQUAL(4, fields[0].length);
+	TEST_ASSERT_EQUAL_STRING("InAMeeting", activity);
+	TEST_ASSERT_FALSE(fields[1].truncated);
+}
+
+void test_skips_nested_values() {
+	MemoryStream stream(" {\n \"a\": {\"activity\": \"x\", \"b\": [1, {\"c\": \"}\"}]},\n"
+		" \"availability\": \"Away\", \"n\": -1.5e3, \"t\": true, \"activity\" : \"Away\" }");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL_STRING("Away", availability);
+	TEST_ASSERT_EQUAL_STRING("Away", activity);
+}
+
+void test_literal_value() {
+	MemoryStream stream("{\"availability\":null,\"activity\":42}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL_STRING("null", availability);
+	TEST_ASSERT_EQUAL_STRING("42", activity);
+}
+
+void test_escapes() {
+	MemoryStream stream("{\"activity\":\"a\\\"b\\\\c\\n\\u00e9\"}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL_STRING("a\"b\\c\n?", activity);
+	TEST_ASSERT_FALSE(fields[0].found);
+}
+
+void test_truncated_value() {
+	MemoryStream stream("{\"availability\":\"0123456789abcdefghij\"}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_TRUE(fields[0].truncated);
+	TEST_ASSERT_EQUAL(sizeof(availability) - 1, fields[0].length);
+	TEST_ASSERT_EQUAL_STRING("0123456789abcde", availability);
+}
+
+void test_long_key_does_not_match() {
+	MemoryStream stream("{\"activityactivityactivityactivityactivity\":\"x\",\"activity\":\"Away\"}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL_STRING("Away", activity);
+}
+
+void test_empty_object() {
+	MemoryStream stream("{}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_FALSE(fields[0].found);
+	TEST_ASSERT_FALSE(fields[1].found);
+}
+
+void test_invalid() {
+	const char* invalid[] = { "", "[]", "{\"a\" 1}", "{\"a\":1 2}", "{\"a\":\"b", "{\"a\":{\"b\":1}", "{\"a\":1" };
+	for (const char* json : invalid) {
+		MemoryStream stream(json);
+		stream.setTimeout(100);
+		TEST_ASSERT_FALSE(JsonStreamReader(stream).readFields(fields, 2));
+	}
+}
+
+// Data arriving in small packets is read the same way
+void test_packets() {
+	const char* json = "{\"availability\":\"DoNotDisturb\",\"activity\":\"Presenting\"}";
+	MemoryStream stream(json, 0, 3);
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL_STRING("DoNotDisturb", availability);
+	TEST_ASSERT_EQUAL_STRING("Presenting", activity);
+	TEST_ASSERT_EQUAL(0, stream.left());
+}
+
+// The reader never allocates
+void test_no_heap() {
+	resetHeapStats();
+	MemoryStream stream("{\"availability\":\"Busy\",\"activity\":\"InACall\"}");
+	TEST_ASSERT_TRUE(JsonStreamReader(stream).readFields(fields, 2));
+	TEST_ASSERT_EQUAL(0, shimHeap().allocations);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_presence);
+	RUN_TEST(test_skips_nested_values);
+	RUN_TEST(test_literal_value);
+	RUN_TEST(test_escapes);
+	RUN_TEST(test_truncated_value);
+	RUN_TEST(test_long_key_does_not_match);
+	RUN_TEST(test_empty_object);
+	RUN_TEST(test_invalid);
+	RUN_TEST(test_packets);
+	RUN_TEST(test_no_heap);
+	return UNITY_END();
+}
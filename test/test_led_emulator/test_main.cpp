@@ -0,0 +1,237 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * LED strip emulator, WS2812FX through the firmware's output path to the RMT driver shim
+ *
+ * Set LED_EMULATOR_DUMP to a directory to get the frames of every benchmark run as PPM and
+ * ANSI files, e.g. "cat scan_16.ansi" in a terminal with 24 bit colours.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "bench.h"
+#include "led_emulator.h"
+#include "activity.h"
+#include "animation_table.h"
+
+#define EMULATOR_LEDS 16
+#define EMULATOR_FRAMES 200
+#define FRAME_PERIOD 10000						// Simulated time between service() calls (us)
+#define BENCH_FRAMES 100
+#define BENCH_MAX_RENDER_NS_PER_LED 2000			// Coarse bound, rendering one LED is a few ns
+
+WS2812FX strip(EMULATOR_LEDS, DATAPIN, NEO_GRB + NEO_KHZ800);
+
+void setUp() {
+	buildColorLut(100, COLOR_TEMPERATURE_NEUTRAL);
+	colorFrame = 0;
+	strip.setLength(EMULATOR_LEDS);
+	strip.resetSegments();
+	strip.init();
+	strip.setBrightness(255);
+	strip.setSegment(0, 0, EMULATOR_LEDS - 1, FX_MODE_STATIC, GREEN, 3000, false);
+	strip.start();
+	beginEmulator(strip, EMULATOR_FRAMES);
+}
+
+void tearDown() {}
+
+// Render one frame, as the LED task does after a change of animation
+static void serviceFrame() {
+	advanceClock(FRAME_PERIOD);
+	strip.trigger();
+	strip.service();
+}
+
+void test_static_frame() {
+	serviceFrame();
+	TEST_ASSERT_EQUAL(1, emulator.shows);
+	TEST_ASSERT_EQUAL(1, frameCapture.count);
+	const CapturedFrame& frame = getCapturedFrame(frameCapture, 0);
+	TEST_ASSERT_EQUAL(EMULATOR_LEDS * 3, frame.length);
+	TEST_ASSERT_EQUAL(1, frame.numSegments);
+	TEST_ASSERT_EQUAL(FX_MODE_STATIC, frame.modes[0]);
+	uint8_t rgb[3];
+	getFrameRgb(frame, EMULATOR_LEDS - 1, rgb);
+	TEST_ASSERT_EQUAL(0, rgb[0]);
+	TEST_ASSERT_EQUAL(255, rgb[1]);
+	TEST_ASSERT_EQUAL(0, rgb[2]);
+	// Full brightness, the strip shows what was rendered
+	TEST_ASSERT_EQUAL(EMULATOR_LEDS * 3, emulator.shown.size());
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(getFramePixels(frame), emulator.shown.data(), EMULATOR_LEDS * 3);
+}
+
+// Frames the strip would show go through the colour pipeline
+void test_shown_frame_is_corrected() {
+	buildColorLut(20, COLOR_TEMPERATURE_NEUTRAL);
+	serviceFrame();
+	TEST_ASSERT_EQUAL(EMULATOR_LEDS * 3, emulator.shown.size());
+	TEST_ASSERT_EQUAL(51, emulator.shown[0]);
+	TEST_ASSERT_EQUAL(0, emulator.shown[1]);
+}
+
+// Every frame WS2812FX shows is captured, not only the ones that reach the RMT driver
+void test_every_frame_captured() {
+	strip.setSegment(0, 0, EMULATOR_LEDS - 1, FX_MODE_SCAN, RED, 200, false);
+	for (uint32_t i = 0; i < EMULATOR_FRAMES / 2; i++) {
+		advanceClock(FRAME_PERIOD);
+		strip.service();
+	}
+	TEST_ASSERT_GREATER_THAN(0, emulator.shows);
+	TEST_ASSERT_EQUAL(emulator.shows, frameCapture.count);
+	uint32_t first, end;
+	getCapturedFrames(frameCapture, first, end);
+	TEST_ASSERT_EQUAL(0, first);
+	TEST_ASSERT_EQUAL(emulator.shows, end);
+	TEST_ASSERT_EQUAL(FX_MODE_SCAN, getCapturedFrame(frameCapture, end - 1).modes[0]);
+}
+
+// The ring keeps the latest frames once it is full
+void test_ring_wraps() {
+	resizeEmulator(4);
+	for (uint32_t i = 0; i < 10; i++) {
+		serviceFrame();
+	}
+	uint32_t first, end;
+	getCapturedFrames(frameCapture, first, end);
+	TEST_ASSERT_EQUAL(10, end);
+	TEST_ASSERT_EQUAL(6, first);
+	TEST_ASSERT_EQUAL(millis(), getCapturedFrame(frameCapture, end - 1).time);
+}
+
+void test_all_segment_modes() {
+	strip.setSegment(0, 0, EMULATOR_LEDS / 2 - 1, FX_MODE_STATIC, GREEN, 3000, false);
+	strip.setSegment(1, EMULATOR_LEDS / 2, EMULATOR_LEDS - 1, FX_MODE_BREATH, RED, 3000, false);
+	serviceFrame();
+	const CapturedFrame& frame = getCapturedFrame(frameCapture, 0);
+	TEST_ASSERT_EQUAL(2, frame.numSegments);
+	TEST_ASSERT_EQUAL(FX_MODE_STATIC, frame.modes[0]);
+	TEST_ASSERT_EQUAL(FX_MODE_BREATH, frame.modes[1]);
+}
+
+void test_dump_ppm() {
+	for (uint32_t i = 0; i < 3; i++) {
+		serviceFrame();
+	}
+	FILE* file = tmpfile();
+	TEST_ASSERT_NOT_NULL(file);
+	dumpFrames(file, false);
+	rewind(file);
+	char header[32] = {};
+	TEST_ASSERT_NOT_NULL(fgets(header, sizeof(header), file));
+	TEST_ASSERT_EQUAL_STRING("P6\n", header);
+	TEST_ASSERT_NOT_NULL(fgets(header, sizeof(header), file));
+	TEST_ASSERT_EQUAL_STRING("16 3\n", header);
+	TEST_ASSERT_NOT_NULL(fgets(header, sizeof(header), file));
+	TEST_ASSERT_EQUAL_STRING("255\n", header);
+	uint8_t rgb[3];
+	TEST_ASSERT_EQUAL(3, fread(rgb, 1, 3, file));
+	TEST_ASSERT_EQUAL(0, rgb[0]);
+	TEST_ASSERT_EQUAL(255, rgb[1]);
+	fseek(file, 0, SEEK_END);
+	TEST_ASSERT_EQUAL(strlen("P6\n16 3\n255\n") + 3 * EMULATOR_LEDS * 3, ftell(file));
+	fclose(file);
+}
+
+void test_dump_ansi() {
+	serviceFrame();
+	FILE* file = tmpfile();
+	dumpFrames(file, true);
+	rewind(file);
+	char line[1024] = {};
+	TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), file));
+	TEST_ASSERT_NOT_NULL(strstr(line, " 0 \x1b[48;2;0;255;0m  "));
+	TEST_ASSERT_NOT_NULL(strstr(line, "\x1b[0m\n"));
+	fclose(file);
+}
+
+// Write the frames of a benchmark run to the directory in LED_EMULATOR_DUMP
+static void dumpBenchmark(const char* modeName, uint32_t numLeds) {
+	const char* directory = getenv("LED_EMULATOR_DUMP");
+	if (directory == NULL || numLeds > 1000) {
+		return;
+	}
+	for (uint8_t ansi = 0; ansi < 2; ansi++) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/%s_%u.%s", directory, modeName, numLeds, ansi ? "ansi" : "ppm");
+		FILE* file = fopen(path, "wb");
+		if (file) {
+			dumpFrames(file, ansi);
+			fclose(file);
+		}
+	}
+}
+
+// Render time of service() per animation of the presence table, from 16 LEDs to 10,000. The time
+// spent in customShow() is taken out; it is reported apart, it includes the RMT driver shim.
+void test_benchmark_service() {
+	const uint32_t lengths[] = { 16, 100, 500, 1000, 2500, 10000 };
+	uint8_t modes[ACTIVITY_COUNT];
+	uint8_t numModes = 0;
+	for (uint8_t id = 0; id < ACTIVITY_COUNT; id++) {
+		bool known = false;
+		for (uint8_t i = 0; i < numModes; i++) {
+			known = known || modes[i] == presenceAnimations[id].mode;
+		}
+		if (!known) {
+			modes[numModes++] = presenceAnimations[id].mode;
+		}
+	}
+
+	for (uint8_t m = 0; m < numModes; m++) {
+		const PresenceAnimation* a = NULL;
+		for (uint8_t id = 0; a == NULL && id < ACTIVITY_COUNT; id++) {
+			a = presenceAnimations[id].mode == modes[m] ? &presenceAnimations[id] : NULL;
+		}
+		char modeName[32];
+		snprintf(modeName, sizeof(modeName), "%s", (const char*)strip.getModeName(a->mode));
+		for (char* c = modeName; *c; c++) {
+			*c = *c == ' ' ? '_' : tolower(*c);
+		}
+		for (uint32_t numLeds : lengths) {
+			strip.setLength(numLeds);
+			strip.setSegment(0, 0, numLeds - 1, a->mode, a->color, a->speed, false);
+			double bestRenderNs = 0;
+			double bestShowNs = 0;
+			for (uint8_t run = 0; run < BENCH_RUNS; run++) {
+				resizeEmulator(BENCH_FRAMES);
+				auto start = std::chrono::steady_clock::now();
+				for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+					serviceFrame();
+				}
+				std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+				TEST_ASSERT_EQUAL(BENCH_FRAMES, emulator.shows);
+				double renderNs = (time.count() - emulator.showNs) / emulator.shows;
+				double showNs = emulator.showNs / emulator.shows;
+				bestRenderNs = run == 0 || renderNs < bestRenderNs ? renderNs : bestRenderNs;
+				bestShowNs = run == 0 || showNs < bestShowNs ? showNs : bestShowNs;
+			}
+			printf("%-12s %5u LEDs: render %8.1f us/frame, output %8.1f us/frame\n",
+				modeName, numLeds, bestRenderNs / 1000, bestShowNs / 1000);
+			dumpBenchmark(modeName, numLeds);
+			TEST_ASSERT_LESS_THAN(BENCH_MAX_RENDER_NS_PER_LED * numLeds + 100000, bestRenderNs);
+		}
+	}
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_static_frame);
+	RUN_TEST(test_shown_frame_is_corrected);
+	RUN_TEST(test_every_frame_captured);
+	RUN_TEST(test_ring_wraps);
+	RUN_TEST(test_all_segment_modes);
+	RUN_TEST(test_dump_ppm);
+	RUN_TEST(test_dump_ansi);
+	RUN_TEST(test_benchmark_service);
+	return UNITY_END();
+}
@@ -0,0 +1,106 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Chunked page writer
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "page_writer.h"
+
+std::string page;
+std::vector<size_t> chunks;
+
+void collect(const char* data, size_t length) {
+	page.append(data, length);
+	chunks.push_back(length);
+}
+
+bool placeholder(PageWriter& writer, const char* name) {
+	if (strcmp(name, "NAME") == 0) {
+		writer.printEscaped("<Teams & \"Presence\">");
+		return true;
+	}
+	if (strcmp(name, "LEDS") == 0) {
+		writer.print((uint32_t)16);
+		return true;
+	}
+	return false;
+}
+
+void setUp() {
+	page.clear();
+	chunks.clear();
+}
+
+void tearDown() {}
+
+void test_placeholders() {
+	PageWriter writer(collect);
+	writer.render("<h1>%NAME%</h1><p>%LEDS% LEDs</p>", placeholder);
+	writer.flush();
+	TEST_ASSERT_EQUAL_STRING("<h1>&lt;Teams &amp; &quot;Presence&quot;&gt;</h1><p>16 LEDs</p>", page.c_str());
+	TEST_ASSERT_EQUAL(page.size(), writer.bytesWritten());
+}
+
+// Unknown names, CSS percentages and lone percent signs stay as they are
+void test_unchanged_text() {
+	PageWriter writer(collect);
+	writer.render("width:50%;%UNKNOWN% %lower% %% 100%LEDS%", placeholder);
+	writer.flush();
+	TEST_ASSERT_EQUAL_STRING("width:50%;%UNKNOWN% %lower% %% 10016", page.c_str());
+}
+
+void test_chunks() {
+	PageWriter writer(collect);
+	std::string text(PAGE_CHUNK_SIZE * 2 + 100, 'x');
+	for (size_t i = 0; i < text.size(); i += 10) {
+		writer.write(text.c_str() + i, min((size_t)10, text.size() - i));
+	}
+	writer.flush();
+	TEST_ASSERT_EQUAL(text.size(), page.size());
+	for (size_t i = 0; i + 1 < chunks.size(); i++) {
+		TEST_ASSERT_LESS_OR_EQUAL(PAGE_CHUNK_SIZE, chunks[i]);
+		TEST_ASSERT_GREATER_THAN(PAGE_CHUNK_SIZE - 10, chunks[i]);
+	}
+}
+
+// Blocks larger than the buffer bypass it, the order is kept
+void test_large_block() {
+	PageWriter writer(collect);
+	std::string block(PAGE_CHUNK_SIZE + 1, 'b');
+	writer.print("a");
+	writer.write(block.c_str(), block.size());
+	writer.print("c");
+	writer.flush();
+	TEST_ASSERT_EQUAL_STRING(("a" + block + "c").c_str(), page.c_str());
+	TEST_ASSERT_EQUAL(3, chunks.size());
+}
+
+void test_printf() {
+	PageWriter writer(collect);
+	writer.printf("%s=%d", "leds", 500);
+	writer.flush();
+	TEST_ASSERT_EQUAL_STRING("leds=500", page.c_str());
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_placeholders);
+	RUN_TEST(test_unchanged_text);
+	RUN_TEST(test_chunks);
+	RUN_TEST(test_large_block);
+	RUN_TEST(test_printf);
+	return UNITY_END();
+}
@@ -0,0 +1,102 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Adaptive presence polling scheduler
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "poll_scheduler.h"
+
+PollScheduler scheduler;
+
+void setUp() {
+	scheduler = PollScheduler();
+	initPollScheduler(scheduler, 5, 30, 300, 8, 18);
+}
+
+void tearDown() {}
+
+void test_bounds() {
+	PollScheduler s = PollScheduler();
+	initPollScheduler(s, 60, 30, 10, 0, 0);
+	TEST_ASSERT_EQUAL(30, s.fastInterval);
+	TEST_ASSERT_EQUAL(30, s.maxInterval);
+	TEST_ASSERT_EQUAL(30, s.interval);
+}
+
+void test_working_hours() {
+	TEST_ASSERT_TRUE(isWorkingHour(scheduler, 8));
+	TEST_ASSERT_TRUE(isWorkingHour(scheduler, 17));
+	TEST_ASSERT_FALSE(isWorkingHour(scheduler, 18));
+	TEST_ASSERT_FALSE(isWorkingHour(scheduler, 3));
+	TEST_ASSERT_TRUE(isWorkingHour(scheduler, -1));
+
+	initPollScheduler(scheduler, 5, 30, 300, 22, 6);	// Night shift
+	TEST_ASSERT_TRUE(isWorkingHour(scheduler, 23));
+	TEST_ASSERT_TRUE(isWorkingHour(scheduler, 5));
+	TEST_ASSERT_FALSE(isWorkingHour(scheduler, 12));
+}
+
+void test_fast_polls_after_change() {
+	TEST_ASSERT_EQUAL(30, nextPollInterval(scheduler, false, false, 10));
+	for (uint8_t i = 0; i < POLL_FAST_COUNT; i++) {
+		TEST_ASSERT_EQUAL(5, nextPollInterval(scheduler, i == 0, false, 10));
+	}
+	TEST_ASSERT_EQUAL(30, nextPollInterval(scheduler, false, false, 10));
+	TEST_ASSERT_EQUAL(1, scheduler.changes);
+	TEST_ASSERT_EQUAL(15, getAverageDetectionLatency(scheduler));
+}
+
+void test_backoff() {
+	const uint16_t expected[] = { 60, 120, 240, 300, 300 };
+	for (uint16_t interval : expected) {
+		TEST_ASSERT_EQUAL(interval, nextPollInterval(scheduler, false, false, 22));
+	}
+	// Offline during working hours backs off the same way
+	initPollScheduler(scheduler, 5, 30, 300, 8, 18);
+	TEST_ASSERT_EQUAL(60, nextPollInterval(scheduler, false, true, 10));
+	// Back at work
+	TEST_ASSERT_EQUAL(30, nextPollInterval(scheduler, false, false, 10));
+}
+
+// A change while backed off is followed by fast polls, then backoff starts at the base interval
+void test_change_during_backoff() {
+	for (uint8_t i = 0; i < 5; i++) {
+		nextPollInterval(scheduler, false, true, 22);
+	}
+	TEST_ASSERT_EQUAL(5, nextPollInterval(scheduler, true, true, 22));
+	TEST_ASSERT_EQUAL(150, getAverageDetectionLatency(scheduler));
+	nextPollInterval(scheduler, false, true, 22);
+	nextPollInterval(scheduler, false, true, 22);
+	TEST_ASSERT_EQUAL(30, nextPollInterval(scheduler, false, true, 22));
+	TEST_ASSERT_EQUAL(60, nextPollInterval(scheduler, false, true, 22));
+}
+
+void test_requests_per_hour() {
+	TEST_ASSERT_EQUAL(0, getRequestsPerHour(scheduler));
+	for (uint8_t i = 0; i < 10; i++) {
+		nextPollInterval(scheduler, false, false, 10);
+	}
+	TEST_ASSERT_EQUAL(120, getRequestsPerHour(scheduler));
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_bounds);
+	RUN_TEST(test_working_hours);
+	RUN_TEST(test_fast_polls_after_change);
+	RUN_TEST(test_backoff);
+	RUN_TEST(test_change_during_backoff);
+	RUN_TEST(test_requests_per_hour);
+	return UNITY_END();
+}
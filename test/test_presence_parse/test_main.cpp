@@ -0,0 +1,150 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Presence response parsing, heap use and parse time per response
+ *
+ * Compares the former path (DynamicJsonDocument for the whole body, values copied into
+ * Strings) with the filtered StaticJsonDocument used by pollPresence() and with the
+ * streaming field reader.
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <ArduinoJson.h>
+#include "memory_stream.h"
+#include "bench.h"
+#include "json_stream.h"
+
+// Heap use and parse time only mean something with the real library
+#if !defined(ARDUINOJSON_VERSION_MAJOR) || ARDUINOJSON_VERSION_MAJOR != 6
+#error "test_presence_parse needs ArduinoJson 6 from lib_deps of env:native"
+#endif
+
+#define PRESENCE_LEN 32
+#define MAX_USERS 8
+#define BENCH_ITERATIONS 20000
+
+// DynamicJsonDocument with its allocations counted
+struct CountingAllocator {
+	void* allocate(size_t size) { return shimMalloc(size); }
+	void deallocate(void* ptr) { shimFree(ptr); }
+	void* reallocate(void* ptr, size_t size) { return shimRealloc(ptr, size); }
+};
+typedef BasicJsonDocument<CountingAllocator> CountingJsonDocument;
+
+// Response of /me/presence
+const char* presenceResponse = "{\"@odata.context\":\"https://graph.microsoft.com/v1.0/$metadata#users"
+	"('fa8bf3dc-eca7-46b7-bad1-db199b62afc3')/presence/$entity\",\"id\":\"fa8bf3dc-eca7-46b7-bad1-db199b62afc3\","
+	"\"availability\":\"Busy\",\"activity\":\"InAMeeting\"}";
+
+char availability[PRESENCE_LEN];
+char activity[PRESENCE_LEN];
+
+// Former pollPresence()
+String oldAvailability;
+String oldActivity;
+
+boolean parseOld(Stream& body) {
+	const size_t capacity = JSON_OBJECT_SIZE(4) + 500;
+	CountingJsonDocument responseDoc(capacity);
+	if (deserializeJson(responseDoc, body)) {
+		return false;
+	}
+	oldAvailability = responseDoc["availability"].as<String>();
+	oldActivity = responseDoc["activity"].as<String>();
+	return true;
+}
+
+// pollPresence() and onPollPresence()
+const size_t presenceCapacity = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(MAX_USERS) + MAX_USERS * (JSON_OBJECT_SIZE(3) + 120);
+StaticJsonDocument<presenceCapacity> presenceDoc;
+
+boolean parseFiltered(Stream& body) {
+	StaticJsonDocument<JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(1)> filter;
+	filter["availability"] = true;
+	filter["activity"] = true;
+	filter["error"]["code"] = true;
+	if (deserializeJson(presenceDoc, body, DeserializationOption::Filter(filter))) {
+		return false;
+	}
+	strlcpy(availability, presenceDoc["availability"] | "", PRESENCE_LEN);
+	strlcpy(activity, presenceDoc["activity"] | "", PRESENCE_LEN);
+	return true;
+}
+
+// Streaming field reader, as used for the token responses
+JsonStreamField fields[2];
+
+boolean parseStream(Stream& body) {
+	fields[0] = { "availability", availability, sizeof(availability) };
+	fields[1] = { "activity", activity, sizeof(activity) };
+	return JsonStreamReader(body).readFields(fields, 2);
+}
+
+// Heap used by one parse and the parse time, printed for comparison
+ShimHeapStats measure(const char* name, boolean (*parse)(Stream&)) {
+	resetHeapStats();
+	size_t before = shimHeap().current;
+	MemoryStream stream(presenceResponse);
+	TEST_ASSERT_TRUE(parse(stream));
+	ShimHeapStats stats = shimHeap();
+	stats.peak -= before;
+
+	double ns = benchmarkNs(BENCH_ITERATIONS, [parse]() {
+		MemoryStream stream(presenceResponse);
+		benchSink += parse(stream);
+	});
+	printf("presence parse %-10s %8.2f us/response, %4u bytes in %2u allocations, peak %4u bytes\n",
+		name, ns / 1000, (unsigned int)stats.allocated, stats.allocations, (unsigned int)stats.peak);
+	return stats;
+}
+
+void setUp() {
+	availability[0] = 0;
+	activity[0] = 0;
+	oldAvailability = "";
+	oldActivity = "";
+}
+
+void tearDown() {}
+
+void test_old_path() {
+	ShimHeapStats stats = measure("dynamic", parseOld);
+	TEST_ASSERT_EQUAL_STRING("Busy", oldAvailability.c_str());
+	TEST_ASSERT_EQUAL_STRING("InAMeeting", oldActivity.c_str());
+	// Document and both Strings
+	TEST_ASSERT_GREATER_OR_EQUAL(3, stats.allocations);
+}
+
+void test_filtered_path() {
+	ShimHeapStats stats = measure("filtered", parseFiltered);
+	TEST_ASSERT_EQUAL_STRING("Busy", availability);
+	TEST_ASSERT_EQUAL_STRING("InAMeeting", activity);
+	TEST_ASSERT_EQUAL(0, stats.allocations);
+	TEST_ASSERT_EQUAL(0, stats.peak);
+}
+
+void test_stream_path() {
+	ShimHeapStats stats = measure("stream", parseStream);
+	TEST_ASSERT_EQUAL_STRING("Busy", availability);
+	TEST_ASSERT_EQUAL_STRING("InAMeeting", activity);
+	TEST_ASSERT_EQUAL(0, stats.allocations);
+	TEST_ASSERT_EQUAL(0, stats.peak);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_old_path);
+	RUN_TEST(test_filtered_path);
+	RUN_TEST(test_stream_path);
+	return UNITY_END();
+}
@@ -0,0 +1,258 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * RMT translator and transmit buffers, run against the RMT driver shim
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "bench.h"
+#include "ESP32_RMT_Driver.h"
+
+#define BENCH_LEDS 500
+#define BENCH_ITERATIONS 200
+
+void setUp() {
+	resetRmtShim();
+	rmt_init_lookup();
+}
+
+void tearDown() {}
+
+// Translate a whole buffer in one call, like the driver does for short frames
+static size_t translate(const uint8_t* data, size_t size, rmt_item32_t* items, size_t wanted, size_t& translated) {
+	size_t num = 0;
+	u8_to_rmt(data, items, size, wanted, &translated, &num);
+	return num;
+}
+
+void test_bits_msb_first() {
+	const uint8_t data[2] = { 0xA5, 0 };		// Second byte stands for the reset pulse
+	rmt_item32_t items[16];
+	size_t translated;
+	TEST_ASSERT_EQUAL(9, translate(data, sizeof(data), items, 16, translated));
+	TEST_ASSERT_EQUAL(2, translated);
+	const uint8_t bits[8] = { 1, 0, 1, 0, 0, 1, 0, 1 };
+	for (uint8_t i = 0; i < 8; i++) {
+		TEST_ASSERT_EQUAL(1, items[i].level0);
+		TEST_ASSERT_EQUAL(0, items[i].level1);
+		TEST_ASSERT_EQUAL(bits[i] ? T1_TICKS + T2_TICKS : T1_TICKS, items[i].duration0);
+		TEST_ASSERT_EQUAL(bits[i] ? T3_TICKS : T2_TICKS + T3_TICKS, items[i].duration1);
+	}
+	TEST_ASSERT_EQUAL(0, items[8].level0);
+	TEST_ASSERT_EQUAL(RESET_TICKS / 2 * 2, items[8].duration0 + items[8].duration1);
+}
+
+void test_stops_at_wanted_items() {
+	uint8_t data[33] = { 0 };
+	rmt_item32_t items[64];
+	size_t translated;
+	TEST_ASSERT_EQUAL(64, translate(data, sizeof(data), items, 64, translated));
+	TEST_ASSERT_EQUAL(8, translated);
+}
+
+void test_null_source() {
+	rmt_item32_t items[8];
+	size_t translated = 1;
+	size_t num = 1;
+	u8_to_rmt(NULL, items, 4, 8, &translated, &num);
+	TEST_ASSERT_EQUAL(0, translated);
+	TEST_ASSERT_EQUAL(0, num);
+}
+
+void test_every_byte_value() {
+	uint8_t data[257];
+	for (uint16_t i = 0; i < 256; i++) {
+		data[i] = i;
+	}
+	rmt_tx_init_pins("", 13);
+	rmt_write_sample(RMT_CHANNEL_0, data, sizeof(data), true);
+	const RmtShimChannel& channel = rmtShim().channels[RMT_CHANNEL_0];
+	TEST_ASSERT_FALSE(channel.overflow);
+	TEST_ASSERT_FALSE(channel.resetMissing);
+	TEST_ASSERT_EQUAL(256 * 8 + 1, channel.items);
+	TEST_ASSERT_EQUAL(256, channel.data.size());
+	TEST_ASSERT_EQUAL_MEMORY(data, channel.data.data(), 256);
+}
+
+void test_init_pins() {
+	TEST_ASSERT_EQUAL(2, rmt_tx_init_pins("13,14", 5));
+	TEST_ASSERT_EQUAL(RMT_CHANNEL_0, tx_channels[0]);
+	TEST_ASSERT_EQUAL(RMT_MEM_BLOCKS, tx_channels[1]);
+	TEST_ASSERT_EQUAL(14, rmtShim().channels[tx_channels[1]].gpio);
+	TEST_ASSERT_TRUE(rmtShim().channels[tx_channels[1]].translator == u8_to_rmt);
+
+	resetRmtShim();
+	TEST_ASSERT_EQUAL(1, rmt_tx_init_pins("x", 5));
+	TEST_ASSERT_EQUAL(5, rmtShim().channels[RMT_CHANNEL_0].gpio);
+}
+
+// The strip is split in pixel order, every part ends with the reset pulse
+void test_split_across_channels() {
+	const size_t leds = 7;
+	rmt_tx_init_pins("13,14,15", 5);
+	uint8_t* buffer = rmt_next_tx_buffer(leds * 3 + 1);
+	TEST_ASSERT_NOT_NULL(buffer);
+	for (size_t i = 0; i < leds * 3; i++) {
+		buffer[i] = i + 1;
+	}
+	TEST_ASSERT_EQUAL(ESP_OK, rmt_write_tx_buffer(leds * 3 + 1, 3));
+
+	size_t offset = 0;
+	for (uint8_t i = 0; i < tx_num_channels; i++) {
+		const RmtShimChannel& channel = rmtShim().channels[tx_channels[i]];
+		TEST_ASSERT_EQUAL(1, channel.frames);
+		TEST_ASSERT_FALSE(channel.resetMissing);
+		TEST_ASSERT_EQUAL(0, channel.data.size() % 3);
+		TEST_ASSERT_EQUAL_MEMORY(buffer + offset, channel.data.data(), channel.data.size());
+		offset += channel.data.size();
+	}
+	TEST_ASSERT_EQUAL(leds * 3, offset);
+}
+
+// Ping-pong buffers, an unchanged frame is detected against the one sent before
+void test_unchanged_frame() {
+	const size_t size = 16 * 3 + 1;
+	rmt_tx_init_pins("", 13);
+	uint8_t* first = rmt_next_tx_buffer(size);
+	memset(first, 0x10, size);
+	rmt_write_tx_buffer(size, 3);
+
+	uint8_t* second = rmt_next_tx_buffer(size);
+	TEST_ASSERT_TRUE(first != second);
+	memset(second, 0x10, size);
+	TEST_ASSERT_TRUE(rmt_tx_unchanged(size - 1));
+	second[5] = 0x11;
+	TEST_ASSERT_FALSE(rmt_tx_unchanged(size - 1));
+}
+
+// A strip too long for the heap gets no buffer, a shorter one still does
+void test_buffer_allocation_fails() {
+	rmt_tx_init_pins("", 13);
+	TEST_ASSERT_NULL(rmt_next_tx_buffer(SIZE_MAX / 2));
+	TEST_ASSERT_EQUAL(0, tx_buffer_size);
+	uint8_t* buffer = rmt_next_tx_buffer(16 * 3 + 1);
+	TEST_ASSERT_NOT_NULL(buffer);
+	memset(buffer, 0, 16 * 3 + 1);
+	TEST_ASSERT_EQUAL(ESP_OK, rmt_write_tx_buffer(16 * 3 + 1, 3));
+}
+
+// Former translator with a branch per bit, kept to compare the output and the speed
+static void u8_to_rmt_branchy(const void* src, rmt_item32_t* dest, size_t src_size,
+                         size_t wanted_num, size_t* translated_size, size_t* item_num) {
+    if(src == NULL || dest == NULL) {
+        *translated_size = 0;
+        *item_num = 0;
+        return;
+    }
+    const rmt_item32_t bit0  = {{{ T1_TICKS,            1, T2_TICKS + T3_TICKS, 0 }}}; //Logical 0
+    const rmt_item32_t bit1  = {{{ T1_TICKS + T2_TICKS, 1, T3_TICKS           , 0 }}}; //Logical 1
+    const rmt_item32_t reset = {{{ RESET_TICKS/2      , 0, RESET_TICKS/2      , 0 }}}; //Reset
+    size_t size = 0;
+    size_t num = 0;
+    uint8_t *psrc = (uint8_t *)src;
+    rmt_item32_t* pdest = dest;
+    while (size < src_size && num < wanted_num) {
+      if(size < src_size - 1) { // have more pixel data, so translate into RMT items
+        (pdest++)->val =  (*psrc & 0x80) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x40) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x20) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x10) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x08) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x04) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x02) ? bit1.val : bit0.val;
+        (pdest++)->val =  (*psrc & 0x01) ? bit1.val : bit0.val;
+        num += 8;
+      } else { // no more pixel data, last RMT item is the reset pulse
+        (pdest++)->val =  reset.val;
+        num++;
+      }
+      size++;
+      psrc++;
+    }
+    *translated_size = size;
+    *item_num = num;
+}
+
+typedef void (*Translator)(const void*, rmt_item32_t*, size_t, size_t, size_t*, size_t*);
+
+// Translate a frame in the portions the driver asks for (first the whole RMT memory, then half of it
+// per refill), returns the number of items. All portions go to the same memory like on the RMT.
+static size_t translateFrame(Translator translator, const uint8_t* data, size_t size, rmt_item32_t* items) {
+	size_t wanted = RMT_MEM_BLOCKS * RMT_MEM_ITEM_NUM;
+	size_t offset = 0;
+	size_t total = 0;
+	while (offset < size) {
+		size_t translated = 0;
+		size_t num = 0;
+		translator(data + offset, items, size - offset, wanted, &translated, &num);
+		offset += translated;
+		total += num;
+		wanted = RMT_MEM_BLOCKS * RMT_MEM_ITEM_NUM / 2;
+	}
+	return total;
+}
+
+static uint8_t benchFrame[BENCH_LEDS * 3 + 1];
+static rmt_item32_t benchItems[RMT_MEM_BLOCKS * RMT_MEM_ITEM_NUM + 8];
+
+void test_matches_former_translator() {
+	for (size_t i = 0; i < sizeof(benchFrame); i++) {
+		benchFrame[i] = random(256);
+	}
+	rmt_item32_t items[9];
+	rmt_item32_t former[9];
+	for (size_t i = 0; i < sizeof(benchFrame) - 1; i++) {
+		size_t translated, num, formerTranslated, formerNum;
+		u8_to_rmt(benchFrame + i, items, 2, 9, &translated, &num);
+		u8_to_rmt_branchy(benchFrame + i, former, 2, 9, &formerTranslated, &formerNum);
+		TEST_ASSERT_EQUAL(formerTranslated, translated);
+		TEST_ASSERT_EQUAL(formerNum, num);
+		TEST_ASSERT_EQUAL_MEMORY(former, items, num * sizeof(rmt_item32_t));
+	}
+}
+
+// Items per microsecond for a frame of BENCH_LEDS random pixels, printed for both translators
+void test_benchmark() {
+	for (size_t i = 0; i < sizeof(benchFrame); i++) {
+		benchFrame[i] = random(256);
+	}
+	size_t items = BENCH_LEDS * 3 * 8 + 1;
+	TEST_ASSERT_EQUAL(items, translateFrame(u8_to_rmt, benchFrame, sizeof(benchFrame), benchItems));
+	TEST_ASSERT_EQUAL(items, translateFrame(u8_to_rmt_branchy, benchFrame, sizeof(benchFrame), benchItems));
+
+	double table = benchmarkNs(BENCH_ITERATIONS, []() {
+		benchSink += translateFrame(u8_to_rmt, benchFrame, sizeof(benchFrame), benchItems);
+		benchSink += benchItems[benchSink % 8].val;
+	});
+	double branchy = benchmarkNs(BENCH_ITERATIONS, []() {
+		benchSink += translateFrame(u8_to_rmt_branchy, benchFrame, sizeof(benchFrame), benchItems);
+		benchSink += benchItems[benchSink % 8].val;
+	});
+	printf("RMT translator, %d LEDs: table %.1f items/us (%.1f us/frame), branches %.1f items/us (%.1f us/frame)\n",
+		BENCH_LEDS, items / (table / 1000), table / 1000, items / (branchy / 1000), branchy / 1000);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_bits_msb_first);
+	RUN_TEST(test_stops_at_wanted_items);
+	RUN_TEST(test_null_source);
+	RUN_TEST(test_every_byte_value);
+	RUN_TEST(test_init_pins);
+	RUN_TEST(test_split_across_channels);
+	RUN_TEST(test_unchanged_frame);
+	RUN_TEST(test_buffer_allocation_fails);
+	RUN_TEST(test_matches_former_translator);
+	RUN_TEST(test_benchmark);
+	return UNITY_END();
+}
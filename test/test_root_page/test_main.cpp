@@ -0,0 +1,216 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Root page, heap use of the former String page versus the streamed template
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "page_writer.h"
+#include "root_page.h"
+
+#define VERSION "0.18.1"
+#define SKETCH_SIZE 1048576u
+#define FREE_SKETCH_SPACE 1310720u
+#define FREE_HEAP 180000u
+
+char paramClientIdValue[] = "3837bbf0-30fb-47ad-bce8-f460ba9880c3";
+char paramTenantValue[] = "contoso.onmicrosoft.com";
+char paramPollIntervalValue[] = "30";
+char paramNumLedsValue[] = "16";
+char paramSegmentsValue[] = "";
+char access_token[] = "token";
+
+size_t pageLength = 0;
+size_t pageChunks = 0;
+size_t pageMaxChunk = 0;
+
+// Former handleRoot(), the page was built in one String and sent at once
+size_t renderStringPage() {
+	String s = "<!DOCTYPE html>\n<html lang=\"en\">\n<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1, user-scalable=no\"/>";
+	s += "<link href=\"https://fonts.googleapis.com/css?family=Press+Start+2P\" rel=\"stylesheet\">";
+	s += "<link href=\"https://unpkg.com/nes.css@2.3.0/css/nes.min.css\" rel=\"stylesheet\" />";
+	s += "<style type=\"text/css\">\n";
+	s += "  body {padding:3.5rem}\n";
+	s += "  .ml-s {margin-left:1.0rem}\n";
+	s += "  .mt-s {margin-top:1.0rem}\n";
+	s += "  .mt {margin-top:3.5rem}\n";
+	s += "  #dialog-devicelogin {max-width:800px}\n";
+	s += "</style>\n";
+	s += "<script>\n";
+	s += "function closeDeviceLoginModal() {\n";
+	s += "  document.getElementById('dialog-devicelogin').close();\n";
+	s += "}\n";
+	s += "function performClearSettings() {\n";
+	s += "  fetch('/api/clearSettings').then(r => r.json()).then(data => {\n";
+	s += "    console.log('clearSettings', data);\n";
+	s += "    document.getElementById('dialog-clearsettings').close();\n";
+	s += "    document.getElementById('dialog-clearsettings-result').showModal();\n";
+	s += "  });\n";
+	s += "}\n";
+	s += "function openDeviceLoginModal() {\n";
+	s += "  fetch('/api/startDevicelogin').then(r => r.json()).then(data => {\n";
+	s += "    console.log('startDevicelogin', data);\n";
+	s += "    if (data && data.user_code) {\n";
+	s += "      document.getElementById('btn_open').href = data.verification_uri;\n";
+	s += "      document.getElementById('lbl_message').innerText = data.message;\n";
+	s += "      document.getElementById('code_field').value = data.user_code;\n";
+	s += "    }\n";
+	s += "    document.getElementById('dialog-devicelogin').showModal();\n";
+	s += "  });\n";
+	s += "}\n";
+	s += "</script>\n";
+	s += "<title>ESP32 teams presence</title></head>\n";
+	s += "<body><h2>ESP32 teams presence - v" + String(VERSION) + "</h2>";
+
+	s += "<section class=\"mt\"><div class=\"nes-balloon from-left\">";
+	if (strlen(paramTenantValue) == 0 || strlen(paramClientIdValue) == 0) {
+		s += "<p class=\"note nes-text is-error\">Some settings are missing. Go to <a href=\"config\">configuration page</a> to complete setup.</p></div>";
+	} else {
+		if (strlen(access_token) == 0) {
+			s += "<p class=\"note nes-text is-error\">No authentication infos found, start device login flow to complete widget setup!</p></div>";
+		} else {
+			s += "<p class=\"note nes-text\">Device setup complete, but you can start the device login flow if you need to re-authenticate.</p></div>";
+		}
+		s += "<div><button type=\"button\" class=\"nes-btn\" onclick=\"openDeviceLoginModal()\">Start device login</button></div>";
+	}
+	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-devicelogin\">\n";
+	s += "<p class=\"title\">Start device login</p>\n";
+	s += "<p id=\"lbl_message\"></p>\n";
+	s += "<input type=\"text\" id=\"code_field\" class=\"nes-input\" disabled>\n";
+	s += "<menu class=\"dialog-menu\">\n";
+	s += "<button id=\"btn_close\" class=\"nes-btn\" onclick=\"closeDeviceLoginModal()\">Close</button>\n";
+	s += "<a class=\"nes-btn is-primary ml-s\" id=\"btn_open\" href=\"https://microsoft.com/devicelogin\" target=\"_blank\">Open device login</a>\n";
+	s += "</menu>\n";
+	s += "</dialog>\n";
+	s += "</section>\n";
+
+	s += "<div class=\"nes-balloon from-left mt\">";
+	s += "Go to <a href=\"config\">configuration page</a> to change settings.";
+	s += "</div>";
+	s += "<section class=\"nes-container with-title\"><h3 class=\"title\">Current settings</h3>";
+	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Client-ID</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramClientIdValue) +  "\"></div>";
+	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Tenant hostname / ID</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramTenantValue) +  "\"></div>";
+	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Polling interval (sec)</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramPollIntervalValue) +  "\"></div>";
+	s += "<div class=\"nes-field mt-s\"><label for=\"name_field\">Number of LEDs</label><input type=\"text\" id=\"name_field\" class=\"nes-input\" disabled value=\"" + String(paramNumLedsValue) +  "\"></div>";
+	s += "</section>";
+
+	s += "<section class=\"nes-container with-title mt\"><h3 class=\"title\">Memory usage</h3>";
+	s += "<div>Sketch: " + String(FREE_SKETCH_SPACE - SKETCH_SIZE) + " of " + String(FREE_SKETCH_SPACE) + " bytes free</div>";
+	s += "<progress class=\"nes-progress\" value=\"" + String(SKETCH_SIZE) + "\" max=\"" + String(FREE_SKETCH_SPACE) + "\"></progress>";
+	s += "<div class=\"mt-s\">RAM: " + String(FREE_HEAP) + " of 327680 bytes free</div>";
+	s += "<progress class=\"nes-progress\" value=\"" + String(327680 - FREE_HEAP) + "\" max=\"327680\"></progress>";
+	s += "</section>";
+
+	s += "<section class=\"nes-container with-title mt\"><h3 class=\"title\">Danger area</h3>";
+	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-clearsettings\">\n";
+	s += "<p class=\"title\">Really clear all settings?</p>\n";
+	s += "<button class=\"nes-btn\" onclick=\"document.getElementById('dialog-clearsettings').close()\">Close</button>\n";
+	s += "<button class=\"nes-btn is-error\" onclick=\"performClearSettings()\">Clear all settings</button>\n";
+	s += "</dialog>\n";
+	s += "<dialog class=\"nes-dialog is-rounded\" id=\"dialog-clearsettings-result\">\n";
+	s += "<p class=\"title\">All settings were cleared.</p>\n";
+	s += "</dialog>\n";
+	s += "<div><button type=\"button\" class=\"nes-btn is-error\" onclick=\"document.getElementById('dialog-clearsettings').showModal();\">Clear all settings</button></div>";
+	s += "</section>";
+
+	s += "<div class=\"mt\"><i class=\"nes-icon github\"></i> Find the <a href=\"https://github.com/toblum/ESPTeamsPresence\" target=\"_blank\">ESPTeamsPresence</a> project on GitHub.</i></div>";
+
+	s += "</body>\n</html>\n";
+
+	return s.length();
+}
+
+// Sink of the streamed page, stands in for server.sendContent_P()
+void countChunk(const char* data, size_t length) {
+	pageLength += length;
+	pageChunks++;
+	pageMaxChunk = max(pageMaxChunk, length);
+}
+
+// Same values as rootPagePlaceholder() fills in on the device
+bool placeholder(PageWriter& page, const char* name) {
+	if (strcmp(name, "VERSION") == 0) {
+		page.print(VERSION);
+	} else if (strcmp(name, "LOGIN_STATE") == 0) {
+		page.print("<p class=\"note nes-text\">Device setup complete, but you can start the device login flow if you need to re-authenticate.</p></div>");
+		page.print("<div><button type=\"button\" class=\"nes-btn\" onclick=\"openDeviceLoginModal()\">Start device login</button></div>");
+	} else if (strcmp(name, "CLIENT_ID") == 0) {
+		page.printEscaped(paramClientIdValue);
+	} else if (strcmp(name, "TENANT") == 0) {
+		page.printEscaped(paramTenantValue);
+	} else if (strcmp(name, "POLL_INTERVAL") == 0) {
+		page.printEscaped(paramPollIntervalValue);
+	} else if (strcmp(name, "NUM_LEDS") == 0) {
+		page.printEscaped(paramNumLedsValue);
+	} else if (strcmp(name, "SEGMENTS") == 0) {
+		page.printEscaped(paramSegmentsValue);
+	} else if (strcmp(name, "SKETCH_FREE") == 0) {
+		page.print(FREE_SKETCH_SPACE - SKETCH_SIZE);
+	} else if (strcmp(name, "SKETCH_SPACE") == 0) {
+		page.print(FREE_SKETCH_SPACE);
+	} else if (strcmp(name, "SKETCH_SIZE") == 0) {
+		page.print(SKETCH_SIZE);
+	} else if (strcmp(name, "HEAP_FREE") == 0) {
+		page.print(FREE_HEAP);
+	} else if (strcmp(name, "HEAP_USED") == 0) {
+		page.print(327680 - FREE_HEAP);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void setUp() {
+	resetHeapStats();
+	pageLength = 0;
+	pageChunks = 0;
+	pageMaxChunk = 0;
+}
+
+void tearDown() {}
+
+// The heap peak is at least the whole page, reached after many reallocations
+void test_string_page() {
+	size_t before = shimHeap().current;
+	size_t length = renderStringPage();
+	size_t peak = shimHeap().peak - before;
+	printf("root page String:     %5u bytes, heap peak %5u bytes, %3u allocations\n",
+		(unsigned int)length, (unsigned int)peak, shimHeap().allocations);
+	TEST_ASSERT_GREATER_OR_EQUAL(length, peak);
+	TEST_ASSERT_GREATER_THAN(80, shimHeap().allocations);
+	TEST_ASSERT_EQUAL(before, shimHeap().current);
+}
+
+// No heap at all, the chunk buffer is the only memory the page needs. Template text longer than
+// the buffer is handed to the sink directly from flash, so chunks can be larger than the buffer.
+void test_streamed_page() {
+	size_t before = shimHeap().current;
+	PageWriter page(countChunk);
+	page.render(ROOT_PAGE_TEMPLATE, placeholder);
+	page.flush();
+	printf("root page PageWriter: %5u bytes, heap peak %5u bytes, %3u allocations, %u chunks of max. %u bytes, writer %u bytes on the stack\n",
+		(unsigned int)pageLength, (unsigned int)(shimHeap().peak - before), shimHeap().allocations,
+		(unsigned int)pageChunks, (unsigned int)pageMaxChunk, (unsigned int)sizeof(PageWriter));
+	TEST_ASSERT_EQUAL(pageLength, page.bytesWritten());
+	TEST_ASSERT_GREATER_THAN(3000, pageLength);
+	TEST_ASSERT_EQUAL(0, shimHeap().allocations);
+	TEST_ASSERT_EQUAL(before, shimHeap().peak);
+	TEST_ASSERT_EQUAL_MEMORY("<!DOCTYPE html>", ROOT_PAGE_TEMPLATE, 15);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_string_page);
+	RUN_TEST(test_streamed_page);
+	return UNITY_END();
+}
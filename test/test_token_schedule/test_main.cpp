@@ -0,0 +1,145 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Token refresh schedule, simulated across the point where millis() wraps
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include "token_schedule.h"
+
+#define MILLIS_WRAP 0x100000000ULL				// millis() wraps after 2^32 ms (49.7 days)
+#define SIM_STEP 50								// Time per loop() in ms
+#define SIM_POLL_INTERVAL 30					// Presence poll interval (s)
+#define SIM_RETRY_INTERVAL 30					// Retry after a failed refresh (s), DEFAULT_ERROR_RETRY_INTERVAL
+#define SIM_JOB_TIME 700						// Duration of a network request (ms)
+#define SIM_EXPIRES_IN 3599						// Token lifetime the server returns (s)
+
+enum SimJob { JOB_NONE, JOB_POLL, JOB_REFRESH };
+
+// Presence polling with background refreshes, like SMODEPOLLPRESENCE in statemachine(). The network
+// task runs one job at a time, a refresh fails if failEvery > 0 and the attempt is a multiple of it.
+struct Simulation {
+	TokenSchedule schedule;
+	uint64_t tsPolling;
+	SimJob job;
+	uint64_t jobDone;
+	uint64_t lastPoll;
+	uint64_t maxGap;
+	uint32_t polls;
+	uint32_t pollsAfterWrap;
+	uint32_t pollsExpired;
+	uint32_t refreshes;
+	uint32_t refreshAttempts;
+	uint32_t blockingRefreshes;
+};
+
+Simulation sim;
+
+void runSimulation(uint64_t start, uint64_t duration, uint32_t failEvery) {
+	sim = Simulation();
+	setTokenExpiry(sim.schedule, start, SIM_EXPIRES_IN);
+	sim.tsPolling = start;
+	sim.lastPoll = start;
+	for (uint64_t now = start; now < start + duration; now += SIM_STEP) {
+		// Completion of the job in flight (onPollPresence(), onRefreshToken())
+		if (sim.job != JOB_NONE && now >= sim.jobDone) {
+			if (sim.job == JOB_POLL) {
+				sim.maxGap = max(sim.maxGap, now - sim.lastPoll);
+				sim.lastPoll = now;
+				sim.polls++;
+				sim.pollsAfterWrap += now >= MILLIS_WRAP;
+				sim.tsPolling = now + SIM_POLL_INTERVAL * 1000;
+			} else if (failEvery > 0 && sim.refreshAttempts % failEvery == 0) {
+				delayTokenRefresh(sim.schedule, now, SIM_RETRY_INTERVAL);
+			} else {
+				setTokenExpiry(sim.schedule, now, SIM_EXPIRES_IN);
+				sim.refreshes++;
+			}
+			sim.job = JOB_NONE;
+		}
+
+		// Poll first, the refresh runs in between polls
+		if (now >= sim.tsPolling && sim.job == JOB_NONE) {
+			sim.pollsExpired += getTokenLifetime(sim.schedule, now) <= 0;
+			sim.job = JOB_POLL;
+			sim.jobDone = now + SIM_JOB_TIME;
+		}
+		if (isBackgroundRefreshDue(sim.schedule, now) && sim.job == JOB_NONE) {
+			sim.refreshAttempts++;
+			sim.job = JOB_REFRESH;
+			sim.jobDone = now + SIM_JOB_TIME;
+		}
+		if (sim.job == JOB_NONE && isTokenRefreshRequired(sim.schedule, now)) {
+			// Polling would stop for SMODEREFRESHTOKEN, count it and go on with a fresh token
+			sim.blockingRefreshes++;
+			setTokenExpiry(sim.schedule, now, SIM_EXPIRES_IN);
+		}
+	}
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// Lifetime is signed and continuous where a 32 bit millis() would wrap
+void test_lifetime_across_wrap() {
+	TokenSchedule s = {};
+	setTokenExpiry(s, MILLIS_WRAP - 1000, 3600);
+	TEST_ASSERT_EQUAL(3600, getTokenLifetime(s, MILLIS_WRAP - 1000));
+	TEST_ASSERT_EQUAL(3599, getTokenLifetime(s, MILLIS_WRAP));
+	TEST_ASSERT_EQUAL(0, getTokenLifetime(s, MILLIS_WRAP + 3599 * 1000));
+	TEST_ASSERT_EQUAL(-10, getTokenLifetime(s, MILLIS_WRAP + 3609 * 1000));
+	TEST_ASSERT_TRUE(isTokenRefreshRequired(s, MILLIS_WRAP + 3609 * 1000));
+	TEST_ASSERT_FALSE(isBackgroundRefreshDue(s, MILLIS_WRAP));
+	TEST_ASSERT_TRUE(isBackgroundRefreshDue(s, MILLIS_WRAP + 3000 * 1000));
+}
+
+void test_retry_delay() {
+	TokenSchedule s = {};
+	setTokenExpiry(s, 0, 500);
+	TEST_ASSERT_TRUE(isBackgroundRefreshDue(s, 0));
+	delayTokenRefresh(s, 0, 30);
+	TEST_ASSERT_FALSE(isBackgroundRefreshDue(s, 29999));
+	TEST_ASSERT_TRUE(isBackgroundRefreshDue(s, 30000));
+}
+
+// Ten hours of polling, starting two hours before millis() wraps
+void test_no_presence_gaps() {
+	runSimulation(MILLIS_WRAP - 2 * 3600000ULL, 10 * 3600000ULL, 0);
+	printf("token schedule: %u polls (%u after the wrap), %u refreshes, max. gap %u ms\n",
+		sim.polls, sim.pollsAfterWrap, sim.refreshes, (unsigned int)sim.maxGap);
+	TEST_ASSERT_EQUAL(0, sim.blockingRefreshes);
+	TEST_ASSERT_EQUAL(0, sim.pollsExpired);
+	TEST_ASSERT_GREATER_OR_EQUAL(10 * 3600 / SIM_EXPIRES_IN, sim.refreshes);
+	TEST_ASSERT_GREATER_THAN(7 * 3600 / (SIM_POLL_INTERVAL + 1), sim.pollsAfterWrap);
+	// A poll is at most delayed by one refresh in flight
+	TEST_ASSERT_LESS_OR_EQUAL(SIM_POLL_INTERVAL * 1000 + 2 * SIM_JOB_TIME + SIM_STEP, sim.maxGap);
+}
+
+// Every second refresh fails, the retries still finish long before the token expires
+void test_no_presence_gaps_with_failed_refreshes() {
+	runSimulation(MILLIS_WRAP - 2 * 3600000ULL, 10 * 3600000ULL, 2);
+	TEST_ASSERT_EQUAL(0, sim.blockingRefreshes);
+	TEST_ASSERT_EQUAL(0, sim.pollsExpired);
+	TEST_ASSERT_GREATER_THAN(sim.refreshes, sim.refreshAttempts);
+	TEST_ASSERT_LESS_OR_EQUAL(SIM_POLL_INTERVAL * 1000 + 2 * SIM_JOB_TIME + SIM_STEP, sim.maxGap);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_lifetime_across_wrap);
+	RUN_TEST(test_retry_delay);
+	RUN_TEST(test_no_presence_gaps);
+	RUN_TEST(test_no_presence_gaps_with_failed_refreshes);
+	return UNITY_END();
+}
@@ -0,0 +1,115 @@
+/**
+ * ESPTeamsPresence -- A standalone Microsoft Teams presence light
+ *   based on ESP32 and RGB neopixel LEDs.
+ *   https://github.com/toblum/ESPTeamsPresence
+ *
+ * Copyright (C) 2020 Tobias Blum <make@tobiasblum.de>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/**
+ * Crossfade transitions
+ */
+#include <Arduino.h>
+#include <unity.h>
+#define MAX_NUM_SEGMENTS 10			// As in WS2812FX
+#include "transition.h"
+
+#define LEDS 4
+#define BYTES (LEDS * TRANSITION_BYTES_PER_LED)
+
+uint8_t oldFrame[BYTES];
+uint8_t newFrame[BYTES];
+uint8_t out[BYTES];
+
+void setUp() {
+	resetTransitions();
+	memset(oldFrame, 200, BYTES);
+	memset(newFrame, 0, BYTES);
+}
+
+void tearDown() {}
+
+void test_weight() {
+	Transition t = { 0, 3, 1000, true };
+	TEST_ASSERT_EQUAL(0, getTransitionWeight(t, 1000));
+	TEST_ASSERT_EQUAL(128, getTransitionWeight(t, 1000 + LED_TRANSITION_TIME / 2));
+	TEST_ASSERT_EQUAL(256, getTransitionWeight(t, 1000 + LED_TRANSITION_TIME));
+	// Eased, slow at both ends
+	TEST_ASSERT_LESS_THAN(256 / 8, getTransitionWeight(t, 1000 + LED_TRANSITION_TIME / 8));
+	TEST_ASSERT_GREATER_THAN(256 * 7 / 8, getTransitionWeight(t, 1000 + LED_TRANSITION_TIME * 7 / 8));
+	// millis() wraps during the transition
+	t.start = 0xFFFFFFFF - LED_TRANSITION_TIME / 2 + 1;
+	TEST_ASSERT_EQUAL(128, getTransitionWeight(t, 0));
+}
+
+void test_crossfade() {
+	startTransition(0, 0, LEDS - 1, oldFrame);
+	TEST_ASSERT_TRUE(transitionActive());
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(oldFrame, out, BYTES);
+
+	advanceClock(LED_TRANSITION_TIME / 2 * 1000);
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL(100, out[0]);
+	TEST_ASSERT_EQUAL(100, out[BYTES - 1]);
+
+	advanceClock(LED_TRANSITION_TIME / 2 * 1000);
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(newFrame, out, BYTES);
+	TEST_ASSERT_FALSE(transitionActive());
+}
+
+// Only the bytes of the segment are blended
+void test_segment() {
+	startTransition(1, 1, 2, oldFrame);
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL(0, out[2]);
+	TEST_ASSERT_EQUAL(200, out[3]);
+	TEST_ASSERT_EQUAL(200, out[8]);
+	TEST_ASSERT_EQUAL(0, out[9]);
+}
+
+// A new animation during a transition fades from what is shown at that moment
+void test_interrupted() {
+	startTransition(0, 0, LEDS - 1, oldFrame);
+	advanceClock(LED_TRANSITION_TIME / 2 * 1000);
+	startTransition(0, 0, LEDS - 1, newFrame);
+	memset(newFrame, 255, BYTES);
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL(100, out[0]);
+}
+
+void test_ignored() {
+	startTransition(MAX_NUM_SEGMENTS, 0, LEDS - 1, oldFrame);
+	startTransition(0, 0, TRANSITION_MAX_LEDS, oldFrame);
+	TEST_ASSERT_FALSE(transitionActive());
+
+	startTransition(0, 0, LEDS - 1, oldFrame);
+	resetTransitions();
+	applyTransition(newFrame, out, BYTES);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(newFrame, out, BYTES);
+}
+
+// A segment longer than the frame sent is cut
+void test_shorter_frame() {
+	startTransition(0, 0, LEDS - 1, oldFrame);
+	memset(out, 7, BYTES);
+	applyTransition(newFrame, out, BYTES - 3);
+	TEST_ASSERT_EQUAL(200, out[BYTES - 4]);
+	TEST_ASSERT_EQUAL(7, out[BYTES - 3]);
+}
+
+int main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_weight);
+	RUN_TEST(test_crossfade);
+	RUN_TEST(test_segment);
+	RUN_TEST(test_interrupted);
+	RUN_TEST(test_ignored);
+	RUN_TEST(test_shorter_frame);
+	return UNITY_END();
+}